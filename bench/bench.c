@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <strlib.h>
+#include <time.h>
+#include <ring.h>
+
+// The number of processes to fork, and how long each one spins before exiting
+#define BENCH_TASKS 256
+#define BENCH_SPINS 20000000
+
+// An unused system call number, which the kernel turns away as soon as it arrives, and how many to time
+#define SYS_null 0xFFFF
+#define BENCH_SYSCALLS 100000
+
+// How much console output to write one line at a time, and the length of each line
+#define BENCH_OUTPUT (1024 * 1024)
+#define BENCH_LINE 64
+
+// How many lines of integers to format
+#define BENCH_FORMATS 100000
+
+// Times a round trip into the kernel and back through the syscall instruction and through int $0x80.
+void bench_null_syscall() {
+  uint64_t start = rdtsc();
+  for (int i = 0; i < BENCH_SYSCALLS; i++) syscall0(SYS_null);
+  uint64_t fast = (rdtsc() - start) / BENCH_SYSCALLS;
+
+  start = rdtsc();
+  for (int i = 0; i < BENCH_SYSCALLS; i++) syscall(SYS_null);
+  uint64_t slow = (rdtsc() - start) / BENCH_SYSCALLS;
+
+  printf("null system call: %lu cycles with syscall, %lu cycles with int $0x80\n", fast, slow);
+}
+
+// Times a clock read from the time page, which never enters the kernel.
+void bench_clock() {
+  uint64_t start = rdtsc();
+  for (int i = 0; i < BENCH_SYSCALLS; i++) clock_ns();
+  uint64_t cycles = (rdtsc() - start) / BENCH_SYSCALLS;
+  printf("clock_ns: %lu cycles, %lu ns since boot\n", cycles, clock_ns());
+}
+
+// Takes every completion off the completion ring, counting failed writes.
+static uint64_t bench_reap(ring_t* ring) {
+  uint64_t failed = 0;
+  ring_cqe_t cqe;
+  while (ring_complete(ring, &cqe)) {
+    if (cqe.result != BENCH_LINE) failed++;
+  }
+  return failed;
+}
+
+// Writes BENCH_OUTPUT bytes of console output with a write system call per line, then again through the
+// submission ring with one ring_enter per ring's worth of lines.
+void bench_ring() {
+  char line[BENCH_LINE];
+  for (int i = 0; i < BENCH_LINE - 1; i++) line[i] = 'a' + i % 26;
+  line[BENCH_LINE - 1] = '\n';
+
+  uint64_t start = rdtsc();
+  for (int i = 0; i < BENCH_OUTPUT / BENCH_LINE; i++) write(1, line, BENCH_LINE);
+  uint64_t direct = rdtsc() - start;
+
+  ring_t* ring = ring_setup(0);
+  if (ring == NULL) {
+    printf("Error: ring_setup failed\n");
+    return;
+  }
+  uint64_t failed = 0;
+  start = rdtsc();
+  for (int i = 0; i < BENCH_OUTPUT / BENCH_LINE; i++) {
+    while (!ring_write(ring, 1, line, BENCH_LINE, i)) {
+      ring_enter();
+      failed += bench_reap(ring);
+    }
+  }
+  ring_enter();
+  failed += bench_reap(ring);
+  uint64_t batched = rdtsc() - start;
+
+  printf("%d KiB of output: %lu cycles with write, %lu cycles through the ring (%lu failed)\n",
+         BENCH_OUTPUT / 1024, direct, batched, failed);
+}
+
+// Formats lines full of integers into a buffer, the way a logging-heavy program spends its output time.
+void bench_format() {
+  char buf[PRINTF_BUFFER_SIZE];
+  uint64_t len = 0;
+  uint64_t start = rdtsc();
+  for (int i = 0; i < BENCH_FORMATS; i++) {
+    len += snprintf(buf, sizeof(buf), "%d %u %x %lu %08d %-6d|\n", -i, i * 7919U, i, start + i, i, i % 1000);
+  }
+  uint64_t cycles = (rdtsc() - start) / BENCH_FORMATS;
+  printf("snprintf: %lu cycles per line (%lu bytes formatted)\n", cycles, len);
+}
+
+// Forks many short CPU-bound processes for the scheduler to spread across CPUs. A kernel built with
+// -DSCHED_BENCHMARK prints how long they took once the last one exits; run with SMP=1, 2, 4, ... to
+// see how throughput scales.
+void _start() {
+  bench_null_syscall();
+  bench_clock();
+  bench_ring();
+  bench_format();
+
+  printf("Forking %d processes\n", BENCH_TASKS);
+  for (int i = 0; i < BENCH_TASKS; i++) {
+    int64_t pid = fork();
+    if (pid < 0) {
+      printf("Error: fork failed after %d processes\n", i);
+      break;
+    }
+    if (pid == 0) {
+      for (volatile uint64_t spin = 0; spin < BENCH_SPINS; spin++) {}
+      exit(0);
+    }
+  }
+  exit(0);
+}
@@ -6,6 +6,43 @@
 #include <stdio.h>
 #include <strlib.h>
 
+// The most kernel log entries the dmesg built-in prints
+#define DMESG_ENTRIES 1024
+
+/**
+ * Prints how often each system call has been made, how long it took on average, and a histogram of how
+ * long each call took.
+ */
+void print_syscall_stats() {
+  syscall_stats_t stats[NUM_SYSCALLS];
+  int64_t count = syscall_stats(stats, NUM_SYSCALLS);
+  for (int64_t nr = 0; nr < count; nr++) {
+    if (stats[nr].count == 0) continue;
+    printf("%s: %lu calls, %lu cycles on average\n", syscall_name(nr), stats[nr].count,
+           stats[nr].cycles / stats[nr].count);
+    for (int bucket = 0; bucket < SYSCALL_HISTOGRAM_BUCKETS; bucket++) {
+      if (stats[nr].histogram[bucket] != 0) printf("  2^%d cycles: %lu\n", bucket, stats[nr].histogram[bucket]);
+    }
+  }
+}
+
+/**
+ * Prints the kernel log, like dmesg. Each message is prefixed with the time-stamp counter when it was
+ * logged and the CPU that logged it.
+ */
+void print_kernel_log() {
+  // The log is too big for the stack, so it is read into memory from mmap
+  static log_entry_t* entries = NULL;
+  if (entries == NULL) {
+    entries = mmap(NULL, DMESG_ENTRIES * sizeof(log_entry_t), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  }
+  int64_t count = readlog(entries, DMESG_ENTRIES);
+  for (int64_t i = 0; i < count; i++) {
+    printf("[%lu cpu%d] ", entries[i].tsc, entries[i].cpu);
+    fwrite(entries[i].text, 1, entries[i].len, stdout);
+  }
+}
+
 void _start() {
   // Print a notification that the shell is running
   printf("Shell\n");
@@ -24,8 +61,18 @@ void _start() {
     char* input_trunc = strsep(&input, "\n");
     // Skip blank lines
     if (stringlen(input_trunc) == 0) continue;
+    // Built-in commands
+    if (strcmp(input_trunc, "stats") == 0) {
+      print_syscall_stats();
+      continue;
+    }
+    if (strcmp(input_trunc, "dmesg") == 0) {
+      print_kernel_log();
+      continue;
+    }
     int64_t rc = exec(input_trunc);
-    // If this point is reached, an error occurred. Print an error message.
+    // A non-negative result is the program's exit code. Anything else is an error, so print a message.
+    if (rc >= 0) continue;
     if (rc == -1) printf("Error: requested program not found.\n");
     else if (rc == -2) printf("Error: requested file not executable.\n");
     else if (rc == -3) printf("Error: failed to allocate memory for requested program.\n");
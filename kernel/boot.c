@@ -19,15 +19,17 @@
 #include "gdt.h"
 #include "usermode_entry.h"
 #include "loader.h"
+#include "kmem.h"
+#include "process.h"
+#include "pit.h"
+#include "smp.h"
+#include "lapic.h"
+#include "clock.h"
 
 #define MEMMAP_TAG_ID 0x2187f79e8612de07
 #define HHDM_TAG_ID 0xb0ed257db18cb58f
 #define MODULES_TAG_ID 0x4b6fe466aade04ce
-
-#define MAX_MEM_SECTIONS 10
-
-#define SYS_read 0
-#define SYS_write 1
+#define CMDLINE_TAG_ID 0xe5e76a1b4597a781
 
 uint64_t hhdm_base_global;
 struct stivale2_struct_tag_modules* modules_tag_global;
@@ -35,10 +37,19 @@ struct stivale2_struct_tag_modules* modules_tag_global;
 // Reserve space for the stack
 static uint8_t stack[8192];
 
+// Request that the bootloader start the other CPUs and park them until the kernel sends them somewhere
+static struct stivale2_header_tag_smp smp_hdr_tag = {
+  .tag = {
+    .identifier = STIVALE2_HEADER_TAG_SMP_ID,
+    .next = 0
+  },
+  .flags = 0 // Use xAPIC mode
+};
+
 // Request 0x0 be unmapped
 static struct stivale2_tag unmap_null_hdr_tag = {
   .identifier = STIVALE2_HEADER_TAG_UNMAP_NULL_ID,
-  .next = 0
+  .next = (uintptr_t)&smp_hdr_tag
 };
 
 // Request a terminal from the bootloader
@@ -117,41 +128,21 @@ void print_mem_address(struct stivale2_struct* hdr) {
 }
 
 /**
- * Fills an array with the start and end addresses of the usable memory regions.
- * The even indices are the start addresses while the odd indices are the end addresses.
- * Each pair of indices is one range.
- * \param hdr A pointer to the stivale2 header structure.
- * \param result The array to fill.
- * \returns The number of regions found.
+ * Converts a pointer representing a physical address to its virtual address.
+ * \param ptr A pointer to be converted.
+ * \returns The converted pointer.
  */
-uint16_t get_mem_address(struct stivale2_struct* hdr, uint64_t* result) {
-  // Find the hhdm and memmap tags in the list
-  struct stivale2_struct_tag_memmap* memmap_tag = find_tag(hdr, MEMMAP_TAG_ID);
-  uint64_t memmap_base;
-  uint64_t memmap_end;
-  uint16_t index = 0;
-
-  // Loop over the entries of the memmap
-  for (int i = 0; i < memmap_tag->entries; i++) {
-    // If the entry is usable, process it
-    if (memmap_tag->memmap[i].type == 1) {
-      // Find the start and end address of the usable range
-      memmap_base = memmap_tag->memmap[i].base;
-      memmap_end = memmap_base + memmap_tag->memmap[i].length;
-      result[index++] = memmap_base;
-      result[index++] = memmap_end;
-    }
-  }
-  return index;
+void* phys_to_vir(void* ptr) {
+  return (void*) (hhdm_base_global + (uint64_t) ptr);
 }
 
 /**
- * Converts a pointer representing a physical address to its virtual address.
+ * Converts a pointer into the higher half direct map to the physical address it maps.
  * \param ptr A pointer to be converted.
  * \returns The converted pointer.
  */
-void* phys_to_vir(void* ptr) {
-  return (void*) (hhdm_base_global + (uint64_t) ptr);
+void* vir_to_phys(void* ptr) {
+  return (void*) ((uint64_t) ptr - hhdm_base_global);
 }
 
 /**
@@ -163,69 +154,30 @@ struct stivale2_struct_tag_modules* get_modules_tag() {
 }
 
 /**
- * Handles system calls by choosing the correct function to process a given call.
- * The arguments passed should match those of the handler function.
- * \param nr The system call number.
- * \param arg0 The first argument to pass to the handler function.
- * \param arg1 The second argument to pass to the handler function.
- * \param arg2 The third argument to pass to the handler function.
- * \param arg3 The fourth argument to pass to the handler function.
- * \param arg4 The fifth argument to pass to the handler function.
- * \param arg5 The sixth argument to pass to the handler function.
- * \returns The value returned by the chosen handler function, or -1 if no function was chosen (invalid system call number)
- */
-int64_t syscall_handler(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
-  int64_t rc;
-  // pick a system call
-  switch(nr) {
-    case 0: // read
-      rc = sys_read(arg0, (void*) arg1, arg2);
-      break;
-    case 1: // write
-      rc = sys_write(arg0, (void*) arg1, arg2);
-      break;
-    case 2: // mmap
-      rc = sys_mmap((void*) arg0, arg1, arg2, arg3, arg4, arg5);
-      break;
-    case 3: // exec
-      rc = sys_exec((char*) arg0);
-      break;
-    case 4: // exit
-      rc = sys_exit(arg0);
-      break;
-    default:
-      rc = -1;
-      break;
-  }
-  return rc;
-}
-
-/**
- * Initializes the freelist.
+ * Initializes the physical memory allocator with the usable ranges of the stivale2 memory map.
  * \param hdr A pointer to the stivale2 header.
  */
 void mem_init(struct stivale2_struct* hdr) {
-  uint64_t get_addr_result[MAX_MEM_SECTIONS];
-  uint64_t start[MAX_MEM_SECTIONS];
-  uint64_t end[MAX_MEM_SECTIONS];
-  uint16_t num_read;
-
-  // Fill array to pass to freelist_init
-  num_read = get_mem_address(hdr, get_addr_result);
-  // Separate start and end addresses
-  int start_index = 0;
-  int end_index = 0;
-  for (int i = 0; i < num_read; i++) {
-    if (i % 2 == 0) start[start_index++] = get_addr_result[i];
-    else end[end_index++] = get_addr_result[i];
+  struct stivale2_struct_tag_memmap* memmap_tag = find_tag(hdr, MEMMAP_TAG_ID);
+  uint64_t start[PMEM_MAX_RANGES];
+  uint64_t end[PMEM_MAX_RANGES];
+  uint16_t num_sections = 0;
+
+  // Collect the usable ranges of the memory map
+  for (int i = 0; i < memmap_tag->entries && num_sections < PMEM_MAX_RANGES; i++) {
+    if (memmap_tag->memmap[i].type == 1) {
+      start[num_sections] = memmap_tag->memmap[i].base;
+      end[num_sections] = memmap_tag->memmap[i].base + memmap_tag->memmap[i].length;
+      num_sections++;
+    }
   }
   kprintf("Initializing freelist...\n");
-  freelist_init(start, end, (num_read / 2));
-  kprintf("Freelist initialized with %d sections.\n", (num_read / 2));
+  freelist_init(start, end, num_sections);
+  kprintf("Freelist initialized with %d sections.\n", num_sections);
 }
 
 //extern int64_t syscall(uint64_t nr, ...);
-// Assembly function to handle system calls. Calls syscall_handler.
+// Assembly function to handle system calls made with int $0x80. Calls syscall_handler.
 extern void syscall_entry();
 
 void _start(struct stivale2_struct* hdr) {
@@ -236,6 +188,9 @@ void _start(struct stivale2_struct* hdr) {
   // Find the module tag
   modules_tag_global = find_tag(hdr, MODULES_TAG_ID);
 
+  // Point GS at the bootstrap processor's per-CPU data, which the kernel log reads
+  smp_init_bsp();
+
   // Initialize the terminal.
   term_init();
 
@@ -245,27 +200,51 @@ void _start(struct stivale2_struct* hdr) {
   idt_setup();
 
   // Initialize gdt to prepare to switch to user mode
-  gdt_setup();
+  gdt_setup(0, 0);
 
   pic_unmask_irq(1);
-  // Set handler for system calls
-  idt_set_handler(0x80, syscall_entry, IDT_TYPE_TRAP);
+
+  // Send console output where the command line asks
+  struct stivale2_struct_tag_cmdline* cmdline_tag = find_tag(hdr, CMDLINE_TAG_ID);
+  console_init(cmdline_tag == NULL ? NULL : (const char*) cmdline_tag->cmdline);
+
+  // Set handler for system calls made with int $0x80. gdt_setup sets up the syscall instruction. It is an
+  // interrupt gate so syscall_entry can swap the GS base before any interrupt arrives.
+  idt_set_handler(0x80, syscall_entry, IDT_TYPE_INTERRUPT);
 
   // Print usable memory ranges
   print_mem_address(hdr);
 
   // Enable write protection
   uint64_t cr0 = read_cr0();
-  cr0 |= 0x10000;
+  cr0 |= CR0_WP;
   write_cr0(cr0);
 
   // Freelist initialization. The code in this function was moved to its own function at the last minute
   // so hopefully nothing broke.
   mem_init(hdr);
 
+  // Set up the kernel object allocator on top of the physical memory allocator
+  kmem_init();
+
+  // Start the other CPUs while the bootloader code they are parked in is still mapped
+  smp_init(hdr);
+
   // Unmap lower half.
   unmap_lower_half(read_cr3() & 0xFFFFFFFFFFFFF000);
 
+  // Keep kernel translations in the TLB across address space changes
+  vm_init_tlb(read_cr3() & 0xFFFFFFFFFFFFF000);
+
+#ifdef PMEM_BENCHMARK
+  // Most of memory is still free, so the benchmark won't run out of blocks
+  pmem_benchmark();
+#endif
+#ifdef VM_BENCHMARK
+  // The lower half is empty now, so the benchmark has it to itself
+  vm_benchmark();
+#endif
+
   /* MMAP TESTS */
 
   /*int* test = (int*) mmap(NULL, 0x5000 + 1, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
@@ -315,12 +294,34 @@ void _start(struct stivale2_struct* hdr) {
   //__asm__("int $20");
   //__asm__("int $21");
   
-  // Initialize the shell
-  run_exec_elf("init", get_modules_tag());
+  // The boot thread becomes the kernel's process, which keeps the shell running
+  process_init();
+
+  // Start the timer that keeps time, then measure each CPU's local APIC timer against it to drive preemption
+  pit_init(TIMER_HZ);
+  pic_unmask_irq(0);
+  lapic_init();
+  lapic_timer_calibrate(TIMER_HZ);
+  lapic_timer_start();
+
+  // Give processes a clock they can read without a system call
+  if (!clock_init()) kprintf("Failed to set up the time page.\n");
+
+  // Let the other CPUs start running processes
+  smp_release();
+
+  // The kernel's process holds the kernel lock like any process in the kernel
+  kernel_lock();
+
+  // Run the shell, starting a fresh one whenever it exits
+  process_t* shell;
+  while (process_spawn("init", &shell) == 0) {
+    process_wait(shell);
+  }
 
   // Print error if loading init failed.
   kprintf("Failed to load init. Hanging.\n");
 
 	// We're done, just hang...
-	halt();
+	idle();
 }
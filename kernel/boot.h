@@ -2,6 +2,14 @@
 
 #include "stivale2.h"
 
+/**
+ * Finds a tag with a given ID in the stivale2 structure.
+ * \param hdr A pointer to the stivale2 header.
+ * \param id The ID of the tag to find.
+ * \returns A pointer to the tag, or NULL if the bootloader did not provide it.
+ */
+void* find_tag(struct stivale2_struct* hdr, uint64_t id);
+
 /**
  * Converts a pointer representing a physical address to its virtual address.
  * \param ptr A pointer to be converted.
@@ -9,6 +17,13 @@
  */
 void* phys_to_vir(void* ptr);
 
+/**
+ * Converts a pointer into the higher half direct map to the physical address it maps.
+ * \param ptr A pointer to be converted.
+ * \returns The converted pointer.
+ */
+void* vir_to_phys(void* ptr);
+
 /**
  * Obtains the modules tag provided by the bootloader.
  * \returns A pointer to the modules tag.
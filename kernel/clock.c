@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time_page.h>
+
+#include "clock.h"
+#include "cpu.h"
+#include "pit.h"
+#include "page.h"
+#include "boot.h"
+
+// The number of PIT ticks the calibration runs for
+#define CLOCK_CALIBRATE_TICKS 10
+
+// The fixed-point precision of the cycles-to-nanoseconds factor
+#define CLOCK_SHIFT 32
+
+// The physical address of the time page, and where the kernel writes to it
+uintptr_t time_page_phys = 0;
+time_page_t* time_page = NULL;
+
+/**
+ * Measures the time-stamp counter's frequency against the PIT and sets up the time page that processes
+ * read the clock from. Must be called on the bootstrap processor with interrupts enabled, after the PIT
+ * is started.
+ * \returns true on success, or false if memory ran out.
+ */
+bool clock_init() {
+  // Count cycles over a whole number of PIT ticks
+  uint64_t start = pit_ticks();
+  while (pit_ticks() == start) __asm__ volatile("hlt");
+  uint64_t tsc_start = rdtsc();
+  while (pit_ticks() < start + 1 + CLOCK_CALIBRATE_TICKS) __asm__ volatile("hlt");
+  uint64_t tsc_hz = (rdtsc() - tsc_start) * TIMER_HZ / CLOCK_CALIBRATE_TICKS;
+
+  time_page_phys = pmem_alloc_zeroed();
+  if (time_page_phys == 0) return false;
+  time_page = phys_to_vir((void*) time_page_phys);
+
+  // Nothing reads the page yet, so it is filled in without the sequence counter
+  time_page->shift = CLOCK_SHIFT;
+  time_page->mult = (1000000000UL << CLOCK_SHIFT) / tsc_hz;
+  time_page->tsc_base = rdtsc();
+  time_page->ns_base = pit_ticks() * (1000000000 / TIMER_HZ);
+  return true;
+}
+
+/**
+ * Moves the time page's base forward to the current time. Called from the PIT interrupt handler.
+ */
+void clock_tick() {
+  if (time_page == NULL) return;
+
+  // Rebasing keeps the TSC difference readers multiply small. The new base continues the old one
+  // rather than following the PIT, so the clock never jumps backwards.
+  uint64_t tsc = rdtsc();
+  uint64_t ns = time_page->ns_base +
+                (uint64_t) (((unsigned __int128) (tsc - time_page->tsc_base) * time_page->mult) >> time_page->shift);
+
+  __atomic_store_n(&time_page->sequence, time_page->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  time_page->tsc_base = tsc;
+  time_page->ns_base = ns;
+  __atomic_store_n(&time_page->sequence, time_page->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Maps the time page read-only into an address space.
+ * \param root The physical address of the top-level page table structure
+ * \returns true on success, or false if memory ran out.
+ */
+bool clock_map(uintptr_t root) {
+  if (time_page_phys == 0) return false;
+  return vm_map_shared(root, TIME_PAGE_ADDRESS, time_page_phys, true, false, true);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Measures the time-stamp counter's frequency against the PIT and sets up the time page that processes
+ * read the clock from. Must be called on the bootstrap processor with interrupts enabled, after the PIT
+ * is started.
+ * \returns true on success, or false if memory ran out.
+ */
+bool clock_init();
+
+/**
+ * Moves the time page's base forward to the current time. Called from the PIT interrupt handler.
+ */
+void clock_tick();
+
+/**
+ * Maps the time page read-only into an address space.
+ * \param root The physical address of the top-level page table structure
+ * \returns true on success, or false if memory ran out.
+ */
+bool clock_map(uintptr_t root);
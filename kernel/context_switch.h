@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// The number of callee-saved registers context_switch keeps on a stack below the return address.
+// The flags are saved below them.
+#define CONTEXT_SWITCH_SAVED_REGS 6
+
+// The flags a new stack starts with: interrupts enabled, plus the reserved bit that is always set
+#define CONTEXT_SWITCH_INITIAL_FLAGS 0x202
+
+// Assembly function to switch kernel stacks. Saves the current stack pointer in old_sp and resumes
+// whatever was running on new_sp.
+void context_switch(uintptr_t* old_sp, uintptr_t new_sp);
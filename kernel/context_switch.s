@@ -0,0 +1,33 @@
+.global context_switch
+
+# Switches from one kernel stack to another
+# Arguments are:
+#  a pointer to save the current stack pointer in (in %rdi)
+#  the stack pointer to switch to (in %rsi)
+context_switch:
+  # Save the callee-saved registers and flags on the current stack. The return address is already there.
+  # Flags are saved so a stack switched away from inside an interrupt handler resumes with interrupts off,
+  # and one switched away from with interrupts on gets them back.
+  push %rbp
+  push %rbx
+  push %r12
+  push %r13
+  push %r14
+  push %r15
+  pushfq
+
+  # Save the stack pointer and switch to the new stack
+  mov %rsp, (%rdi)
+  mov %rsi, %rsp
+
+  # Restore the flags and callee-saved registers saved on the new stack
+  popfq
+  pop %r15
+  pop %r14
+  pop %r13
+  pop %r12
+  pop %rbx
+  pop %rbp
+
+  # Return to wherever the new stack was switched away from
+  ret
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+// CPUID feature bits
+#define CPUID_1_EDX_PGE (1 << 13)
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+#define CPUID_EXT_EDX_PDPE1GB (1 << 26)
+
+// Cached results of feature checks, since cpuid is slow (and causes a VM exit under virtualization)
+bool cpu_features_read = false;
+bool has_1g_pages = false;
+bool has_pge = false;
+bool has_pcid = false;
+bool has_invpcid = false;
+
+// Read the feature bits we care about once
+static void cpu_read_features() {
+  uint32_t eax, ebx, ecx, edx;
+
+  // Find the highest basic leaf
+  cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  uint32_t max_leaf = eax;
+
+  cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+  has_pge = (edx & CPUID_1_EDX_PGE) != 0;
+  has_pcid = (ecx & CPUID_1_ECX_PCID) != 0;
+
+  if (max_leaf >= 7) {
+    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    has_invpcid = (ebx & CPUID_7_EBX_INVPCID) != 0;
+  }
+
+  // Make sure the extended leaf exists before reading it
+  cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+  if (eax >= 0x80000001) {
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    has_1g_pages = (edx & CPUID_EXT_EDX_PDPE1GB) != 0;
+  }
+
+  cpu_features_read = true;
+}
+
+/**
+ * Checks if the CPU supports 1 GiB pages.
+ * \returns true if 1 GiB pages can be mapped.
+ */
+bool cpu_has_1g_pages() {
+  if (!cpu_features_read) cpu_read_features();
+  return has_1g_pages;
+}
+
+/**
+ * Checks if the CPU supports global pages (CR4.PGE).
+ * \returns true if global pages are supported.
+ */
+bool cpu_has_pge() {
+  if (!cpu_features_read) cpu_read_features();
+  return has_pge;
+}
+
+/**
+ * Checks if the CPU supports process-context identifiers (CR4.PCIDE).
+ * \returns true if PCIDs are supported.
+ */
+bool cpu_has_pcid() {
+  if (!cpu_features_read) cpu_read_features();
+  return has_pcid;
+}
+
+/**
+ * Checks if the CPU supports the invpcid instruction.
+ * \returns true if invpcid is supported.
+ */
+bool cpu_has_invpcid() {
+  if (!cpu_features_read) cpu_read_features();
+  return has_invpcid;
+}
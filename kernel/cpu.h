@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Execute the cpuid instruction for a leaf and subleaf, storing the resulting registers
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+  __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+// Model-specific registers
+#define MSR_APIC_BASE 0x1B
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_SFMASK 0xC0000084
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+// EFER bits that enable the syscall instruction and no-execute pages
+#define EFER_SCE (1 << 0)
+#define EFER_NXE (1 << 11)
+
+// Read a model-specific register
+static inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t low, high;
+  __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+  return ((uint64_t) high << 32) | low;
+}
+
+// Write a model-specific register
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+  __asm__ volatile("wrmsr" :: "a"((uint32_t) value), "d"((uint32_t) (value >> 32)), "c"(msr));
+}
+
+/**
+ * Checks if the CPU supports 1 GiB pages.
+ * \returns true if 1 GiB pages can be mapped.
+ */
+bool cpu_has_1g_pages();
+
+/**
+ * Reads the time-stamp counter.
+ * \returns The number of cycles since the CPU was reset.
+ */
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+  return ((uint64_t) high << 32) | low;
+}
+
+/**
+ * Checks if the CPU supports global pages (CR4.PGE).
+ * \returns true if global pages are supported.
+ */
+bool cpu_has_pge();
+
+/**
+ * Checks if the CPU supports process-context identifiers (CR4.PCIDE).
+ * \returns true if PCIDs are supported.
+ */
+bool cpu_has_pcid();
+
+/**
+ * Checks if the CPU supports the invpcid instruction.
+ * \returns true if invpcid is supported.
+ */
+bool cpu_has_invpcid();
@@ -5,13 +5,24 @@
 #include <stdbool.h>
 #include <strlib.h>
 
+#include "smp.h"
+#include "cpu.h"
+
 #define MAX_GDT_SIZE 256
 
-// Reserve space for interrupt handlers to use as a stack
+// Flags cleared on entry through the syscall instruction: trap, interrupt, direction and alignment check.
+// Interrupts stay off until syscall_fast_entry is on the kernel stack.
+#define SYSCALL_FLAGS_MASK 0x40700
+
+// Entry point for the syscall instruction
+extern void syscall_fast_entry();
+
+// Reserve space for interrupt handlers on the bootstrap processor to use as a stack. Other CPUs
+// bring their own stacks.
 uint8_t interrupt_stack[0x8000];
 
-// Reserve space for a GDT that we'll fill in below
-uint8_t gdt[MAX_GDT_SIZE];
+// Reserve space for a GDT per CPU that we'll fill in below. Every CPU's GDT has the same layout.
+uint8_t gdt[MAX_CPUS][MAX_GDT_SIZE];
 size_t gdt_size = 0;
 
 // Struct definition for a segment descriptor
@@ -25,9 +36,9 @@ typedef struct seg_descriptor {
 } __attribute__((packed)) seg_descriptor_t;
 
 // Create a code descriptor at the specified offset
-void gdt_code_descriptor(uint16_t offset, bool user) {
+void gdt_code_descriptor(uint8_t* table, uint16_t offset, bool user) {
   // Get a pointer to the new descriptor
-  seg_descriptor_t* d = (seg_descriptor_t*)&gdt[offset];
+  seg_descriptor_t* d = (seg_descriptor_t*)&table[offset];
   if (gdt_size < offset + sizeof(seg_descriptor_t)) {
     gdt_size = offset + sizeof(seg_descriptor_t);
   }
@@ -41,9 +52,9 @@ void gdt_code_descriptor(uint16_t offset, bool user) {
 }
 
 // Create a data descriptor at the specified offset
-void gdt_data_descriptor(uint16_t offset, bool user) {
+void gdt_data_descriptor(uint8_t* table, uint16_t offset, bool user) {
   // Get a pointer to the new descriptor
-  seg_descriptor_t* d = (seg_descriptor_t*)&gdt[offset];
+  seg_descriptor_t* d = (seg_descriptor_t*)&table[offset];
   if (gdt_size < offset + sizeof(seg_descriptor_t)) {
     gdt_size = offset + sizeof(seg_descriptor_t);
   }
@@ -73,8 +84,8 @@ typedef struct tss {
   uint16_t iomap;
 } __attribute__((packed)) tss_t;
 
-// Declare a task state segment
-tss_t tss;
+// Declare a task state segment per CPU
+tss_t tss[MAX_CPUS];
 
 // Struct definition for a system descriptor
 typedef struct sys_descriptor {
@@ -88,9 +99,9 @@ typedef struct sys_descriptor {
 } __attribute__((packed)) sys_descriptor_t;
 
 // Create a TSS descriptor at the specified offset
-void gdt_tss_descriptor(uint16_t offset, tss_t* tss) {
+void gdt_tss_descriptor(uint8_t* table, uint16_t offset, tss_t* tss) {
   // Get a pointer to the descriptor
-  sys_descriptor_t* d = (sys_descriptor_t*)&gdt[offset];
+  sys_descriptor_t* d = (sys_descriptor_t*)&table[offset];
   if (gdt_size < offset + sizeof(sys_descriptor_t)) {
     gdt_size = offset + sizeof(sys_descriptor_t);
   }
@@ -115,34 +126,61 @@ typedef struct gdt_record {
   void* base;
 } __attribute__((packed)) gdt_record_t;
 
-void gdt_setup() {
+/**
+ * Sets up and loads the GDT and TSS for a CPU, and points the syscall instruction at the kernel.
+ * \param cpu The index of the running CPU.
+ * \param stack_top The stack to use for interrupts from user mode until a process is running, or 0 to use
+ *                  the bootstrap processor's interrupt_stack.
+ */
+void gdt_setup(uint32_t cpu, uintptr_t stack_top) {
+  uint8_t* table = gdt[cpu];
+
   // Zero out the gdt
-  memset(gdt, 0, sizeof(gdt));
+  memset(table, 0, MAX_GDT_SIZE);
 
   // Create the kernel code and data descriptors
-  gdt_code_descriptor(KERNEL_CODE_SELECTOR, false);
-  gdt_data_descriptor(KERNEL_DATA_SELECTOR, false);
+  gdt_code_descriptor(table, KERNEL_CODE_SELECTOR, false);
+  gdt_data_descriptor(table, KERNEL_DATA_SELECTOR, false);
 
-  // Create the user code and data descriptors
-  gdt_code_descriptor(USER_CODE_SELECTOR, true);
-  gdt_data_descriptor(USER_DATA_SELECTOR, true);
+  // Create the user data and code descriptors
+  gdt_data_descriptor(table, USER_DATA_SELECTOR, true);
+  gdt_code_descriptor(table, USER_CODE_SELECTOR, true);
 
   // Create a TSS descriptor
-  gdt_tss_descriptor(TSS_SELECTOR, &tss);
+  gdt_tss_descriptor(table, TSS_SELECTOR, &tss[cpu]);
 
   // Load the GDT
   gdt_record_t record = {
     .sz = gdt_size - 1,
-    .base = gdt
+    .base = table
   };
   __asm__("lgdt %0" :: "m"(record));
 
   // Zero out the TSS
-  memset(&tss, 0, sizeof(tss));
+  memset(&tss[cpu], 0, sizeof(tss_t));
 
   // Interrupts delivered while in user mode should use this stack pointer
-  tss.rsp0 = (uintptr_t)interrupt_stack + sizeof(interrupt_stack) - 8;
+  if (stack_top == 0) stack_top = (uintptr_t)interrupt_stack + sizeof(interrupt_stack) - 8;
+  tss[cpu].rsp0 = stack_top;
+  this_cpu()->syscall_stack = stack_top;
 
   // Load the TSS
   __asm__("ltr %%ax" :: "a"(TSS_SELECTOR));
+
+  // Enable the syscall instruction. STAR holds the kernel code selector, which syscall loads along with the
+  // data selector after it, and the selector sysret adds 8 to for the user data selector and 16 for the
+  // user code selector.
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+  wrmsr(MSR_STAR, ((uint64_t) (USER_DATA_SELECTOR - 8) << 48) | ((uint64_t) KERNEL_CODE_SELECTOR << 32));
+  wrmsr(MSR_LSTAR, (uintptr_t) syscall_fast_entry);
+  wrmsr(MSR_SFMASK, SYSCALL_FLAGS_MASK);
+}
+
+/**
+ * Sets the stack the CPU switches to when an interrupt or system call arrives from user mode.
+ * \param stack_top The address just past the top of the stack
+ */
+void gdt_set_kernel_stack(uintptr_t stack_top) {
+  tss[this_cpu()->id].rsp0 = stack_top;
+  this_cpu()->syscall_stack = stack_top;
 }
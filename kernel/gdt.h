@@ -1,11 +1,25 @@
 #pragma once
 
-// Define the offsets into the GDT where we'll place important descriptors
+#include <stdint.h>
+
+// Define the offsets into the GDT where we'll place important descriptors. sysret requires the user
+// data descriptor to come right before the user code descriptor.
 #define KERNEL_CODE_SELECTOR 0x28
 #define KERNEL_DATA_SELECTOR 0x30
-#define USER_CODE_SELECTOR 0x38
-#define USER_DATA_SELECTOR 0x40
+#define USER_DATA_SELECTOR 0x38
+#define USER_CODE_SELECTOR 0x40
 #define TSS_SELECTOR 0x48
 
-// Set up and load the GDT
-void gdt_setup();
+/**
+ * Sets up and loads the GDT and TSS for a CPU, and points the syscall instruction at the kernel.
+ * \param cpu The index of the running CPU.
+ * \param stack_top The stack to use for interrupts from user mode until a process is running, or 0 to use
+ *                  the bootstrap processor's interrupt_stack.
+ */
+void gdt_setup(uint32_t cpu, uintptr_t stack_top);
+
+/**
+ * Sets the stack the CPU switches to when an interrupt or system call arrives from user mode.
+ * \param stack_top The address just past the top of the stack
+ */
+void gdt_set_kernel_stack(uintptr_t stack_top);
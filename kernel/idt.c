@@ -8,6 +8,14 @@
 #include "key.h"
 #include "idt.h"
 #include "gdt.h"
+#include "page.h"
+#include "process.h"
+#include "pit.h"
+#include "lapic.h"
+#include "clock.h"
+#include "serial.h"
+#include "log.h"
+#include "smp.h"
 
 // This struct matches the layout of an interrupt context.
 typedef struct interrupt_context {
@@ -18,138 +26,224 @@ typedef struct interrupt_context {
   uint64_t ss;
 } __attribute__((packed)) interrupt_context_t;
 
+// Interrupts from user mode arrive with whatever GS base the program set, and the kernel's per-CPU base in
+// MSR_KERNEL_GS_BASE (see smp.h). Handlers swap them before anything uses this_cpu, and swap them back
+// before returning to user mode. Every handler is installed as an interrupt gate, so no other interrupt
+// can arrive before the swap.
+static inline void interrupt_enter(interrupt_context_t* ctx) {
+  if ((ctx->cs & 0x3) == 0x3) __asm__ volatile("swapgs" ::: "memory");
+}
+
+static inline void interrupt_exit(interrupt_context_t* ctx) {
+  if ((ctx->cs & 0x3) == 0x3) __asm__ volatile("swapgs" ::: "memory");
+}
+
 // Definitions of interrupt handlers
 __attribute__((interrupt))
 void divide_error_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Divide by zero\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Divide by zero\n");
   halt();
 }
 
 __attribute__((interrupt))
 void debug_exception_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Debug exception\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Debug exception\n");
   halt();
 }
 
 __attribute__((interrupt))
 void NMI_interrupt_handler(interrupt_context_t* ctx) {
-  kprintf("Interrupt: NMI interrupt\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Interrupt: NMI interrupt\n");
   halt();
 }
 
 __attribute__((interrupt))
 void breakpoint_handler(interrupt_context_t* ctx) {
-  kprintf("Trap: Breakpoint\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Trap: Breakpoint\n");
   halt();
 }
 
 __attribute__((interrupt))
 void overflow_handler(interrupt_context_t* ctx) {
-  kprintf("Trap: Overflow\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Trap: Overflow\n");
   halt();
 }
 
 __attribute__((interrupt))
 void bound_range_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Bound range exceeded\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Bound range exceeded\n");
   halt();
 }
 
 __attribute__((interrupt))
 void invalid_opcode_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Invalid opcode\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Invalid opcode\n");
   halt();
 }
 
 __attribute__((interrupt))
 void device_not_available_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Device not available\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Device not available\n");
   halt();
 }
 
 __attribute__((interrupt))
 void double_fault_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Abort: Double fault (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Abort: Double fault (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void coprocessor_segment_overrun_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Coprocessor segment overrun\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Coprocessor segment overrun\n");
   halt();
 }
 
 __attribute__((interrupt))
 void invalid_tss_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: Invalid tss (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Invalid tss (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void segment_not_present_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: Segment not present (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Segment not present (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void stack_segment_fault_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: Stack-segment fault (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Stack-segment fault (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void general_protection_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: General protection (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: General protection (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void page_fault_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: Page fault (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  uintptr_t address = read_cr2();
+  // The fault may be handled at length, so let interrupts in again if the faulting code allowed them
+  if (ctx->flags & 0x200) __asm__ volatile("sti");
+  process_t* proc = current_process();
+  // Faults from user mode need the kernel lock. The kernel already holds it when it touches user memory.
+  bool locked = !kernel_lock_held();
+  if (locked) kernel_lock();
+  // Give the writer its own copy of a page shared by fork, or back reserved memory on first touch,
+  // then retry the access
+  bool handled = ((ec & PF_PRESENT) && (ec & PF_WRITE) && vm_handle_cow(proc->root, address)) ||
+                 vma_handle_fault(proc->root, proc->vmas, address, ec);
+  if (locked) kernel_unlock();
+  if (handled) {
+    __asm__ volatile("cli");
+    interrupt_exit(ctx);
+    return;
+  }
+
+  klog(LOG_ERROR, "Fault: Page fault at %p (ec=%lu)\n", (void*) address, ec);
   halt();
 }
 
 __attribute__((interrupt))
 void floating_point_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: x87 FPU floating-point error\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: x87 FPU floating-point error\n");
   halt();
 }
 
 __attribute__((interrupt))
 void alignment_check_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: alignment check (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: alignment check (ec=%lu)\n", ec);
   halt();
 }
 
 __attribute__((interrupt))
 void machine_check_handler(interrupt_context_t* ctx) {
-  kprintf("Abort: Machine check\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Abort: Machine check\n");
   halt();
 }
 
 __attribute__((interrupt))
 void simd_floating_point_exception_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: SIMD floating-point exception\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: SIMD floating-point exception\n");
   halt();
 }
 
 __attribute__((interrupt))
 void virtualization_exception_handler(interrupt_context_t* ctx) {
-  kprintf("Fault: Virtualization exception\n");
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Virtualization exception\n");
   halt();
 }
 
 __attribute__((interrupt))
 void control_protection_exception_handler(interrupt_context_t* ctx, uint64_t ec) {
-  kprintf("Fault: Control protection exception (ec=%d)\n", ec);
+  interrupt_enter(ctx);
+  klog(LOG_ERROR, "Fault: Control protection exception (ec=%lu)\n", ec);
   halt();
 }
 
+__attribute__((interrupt))
+void irq0_interrupt_handler(interrupt_context_t* ctx) {
+  interrupt_enter(ctx);
+  pit_tick();
+  clock_tick();
+  log_flush(LOG_FLUSH_ENTRIES);
+  term_flush();
+  outb(PIC1_COMMAND, PIC_EOI);
+  interrupt_exit(ctx);
+}
+
 __attribute__((interrupt))
 void irq1_interrupt_handler(interrupt_context_t* ctx) {
+  interrupt_enter(ctx);
   handle_press(inb(0x60));
   //kprintf("%p\n", inb(0x60));
   outb(PIC1_COMMAND, PIC_EOI);
+  interrupt_exit(ctx);
+}
+
+__attribute__((interrupt))
+void irq4_interrupt_handler(interrupt_context_t* ctx) {
+  interrupt_enter(ctx);
+  serial_interrupt();
+  outb(PIC1_COMMAND, PIC_EOI);
+  interrupt_exit(ctx);
+}
+
+__attribute__((interrupt))
+void lapic_timer_interrupt_handler(interrupt_context_t* ctx) {
+  interrupt_enter(ctx);
+  // Acknowledge the interrupt first, since the tick may switch to another process
+  lapic_eoi();
+  process_tick((ctx->cs & 0x3) == 0x3);
+  interrupt_exit(ctx);
+}
+
+__attribute__((interrupt))
+void lapic_spurious_interrupt_handler(interrupt_context_t* ctx) {
+  // Spurious interrupts are not acknowledged
 }
 
 // Every interrupt handler must specify a code selector. We'll use entry 5 (5*8=0x28), which
@@ -215,30 +309,40 @@ void idt_setup() {
   memset(idt, 0, 256);
 
   // Set handlers for the standard exceptions (0--21)
-  idt_set_handler(0, &divide_error_handler, IDT_TYPE_TRAP);
-  idt_set_handler(1, &debug_exception_handler, IDT_TYPE_TRAP);
+  idt_set_handler(0, &divide_error_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(1, &debug_exception_handler, IDT_TYPE_INTERRUPT);
   idt_set_handler(2, &NMI_interrupt_handler, IDT_TYPE_INTERRUPT);
-  idt_set_handler(3, &breakpoint_handler, IDT_TYPE_TRAP);
-  idt_set_handler(4, &overflow_handler, IDT_TYPE_TRAP);
-  idt_set_handler(5, &bound_range_handler, IDT_TYPE_TRAP);
-  idt_set_handler(6, &invalid_opcode_handler, IDT_TYPE_TRAP);
-  idt_set_handler(7, &device_not_available_handler, IDT_TYPE_TRAP);
-  idt_set_handler(8, &double_fault_handler, IDT_TYPE_TRAP);
-  idt_set_handler(9, &coprocessor_segment_overrun_handler, IDT_TYPE_TRAP);
-  idt_set_handler(10, &invalid_tss_handler, IDT_TYPE_TRAP);
-  idt_set_handler(11, &segment_not_present_handler, IDT_TYPE_TRAP);
-  idt_set_handler(12, &stack_segment_fault_handler, IDT_TYPE_TRAP);
-  idt_set_handler(13, &general_protection_handler, IDT_TYPE_TRAP);
-  idt_set_handler(14, &page_fault_handler, IDT_TYPE_TRAP);
-  idt_set_handler(16, &floating_point_handler, IDT_TYPE_TRAP);
-  idt_set_handler(17, &alignment_check_handler, IDT_TYPE_TRAP);
-  idt_set_handler(18, &machine_check_handler, IDT_TYPE_TRAP);
-  idt_set_handler(19, &simd_floating_point_exception_handler, IDT_TYPE_TRAP);
-  idt_set_handler(20, &virtualization_exception_handler, IDT_TYPE_TRAP);
-  idt_set_handler(21, &control_protection_exception_handler, IDT_TYPE_TRAP);
+  idt_set_handler(3, &breakpoint_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(4, &overflow_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(5, &bound_range_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(6, &invalid_opcode_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(7, &device_not_available_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(8, &double_fault_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(9, &coprocessor_segment_overrun_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(10, &invalid_tss_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(11, &segment_not_present_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(12, &stack_segment_fault_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(13, &general_protection_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(14, &page_fault_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(16, &floating_point_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(17, &alignment_check_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(18, &machine_check_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(19, &simd_floating_point_exception_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(20, &virtualization_exception_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(21, &control_protection_exception_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(IRQ0_INTERRUPT, &irq0_interrupt_handler, IDT_TYPE_INTERRUPT);
   idt_set_handler(IRQ1_INTERRUPT, &irq1_interrupt_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(IRQ4_INTERRUPT, &irq4_interrupt_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(LAPIC_TIMER_INTERRUPT, &lapic_timer_interrupt_handler, IDT_TYPE_INTERRUPT);
+  idt_set_handler(LAPIC_SPURIOUS_INTERRUPT, &lapic_spurious_interrupt_handler, IDT_TYPE_INTERRUPT);
+
+  idt_load();
+}
 
-  // Install the IDT
+/**
+ * Installs the IDT on the running CPU. Every CPU shares the same IDT.
+ */
+void idt_load() {
   idt_record_t record = {
     .size = sizeof(idt),
     .base = idt
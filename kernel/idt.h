@@ -7,6 +7,11 @@
 */
 void idt_setup();
 
+/**
+ * Installs the IDT on the running CPU. Every CPU shares the same IDT.
+ */
+void idt_load();
+
 /**
  * Set an interrupt handler for the given interrupt number.
  *
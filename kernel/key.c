@@ -3,6 +3,7 @@
 #include <ctype.h>
 
 #include "kprint.h"
+#include "wait_queue.h"
 
 #define BUFFER_SIZE 2000
 
@@ -63,9 +64,13 @@ int buffer_read = 0;
 int buffer_write = 0;
 // The number of characters in the buffer.
 volatile int buffer_count = 0;
+// Processes waiting in kgetc for a character
+static wait_queue_t key_waiters;
 
 /**
- * Adds a character to an externally maintained circular buffer of characters.
+ * Adds a character to an externally maintained circular buffer of characters, and wakes the processes
+ * waiting for one. Only called from interrupt handlers on the bootstrap processor, so there is one writer
+ * at a time.
  *
  * \param key Character to add to the buffer.
  * \returns The key that was added.
@@ -74,7 +79,8 @@ char add_to_buffer(uint8_t key) {
   if (buffer_count != BUFFER_SIZE) {
     key_buffer[buffer_write++] = key;
     buffer_write %= BUFFER_SIZE; // Reset the position if needed
-    buffer_count++;
+    __atomic_fetch_add(&buffer_count, 1, __ATOMIC_SEQ_CST);
+    wait_queue_signal(&key_waiters);
     return key;
   }
   return 0;
@@ -95,6 +101,10 @@ void handle_press(uint8_t key_code) {
     right_shift = 0;
     return;
   }
+  if (key_code == 0x9D) {
+    left_control = 0;
+    return;
+  }
   if (key_code > 0x58) return;
   uint8_t key = keys[key_code - 1];
   if (key <= 146 && key >= 128) {
@@ -126,8 +136,13 @@ void handle_press(uint8_t key_code) {
     }
 
   } else if (key == 147) {
-    kprintf("Unexpected scan code\n");
+    klog(LOG_WARN, "Unexpected scan code\n");
   } else {
+    // With control held, letters become control characters, such as Ctrl-U for the terminal's kill
+    if ((left_control || right_control) && isalpha(key)) {
+      add_to_buffer(key & 0x1F);
+      return;
+    }
     // handle caps lock
     if (caps_lock && left_shift == 0 && right_shift == 0) {
       // Capitalize the character if it is a letter.
@@ -163,17 +178,27 @@ void handle_press(uint8_t key_code) {
 }
 
 /**
- * Read one character from the keyboard buffer. If the keyboard buffer is empty this function will
- * block until a key is pressed.
+ * Checks if a character is waiting in the keyboard buffer, so kgetc would return without blocking.
+ *
+ * \returns true if a character is waiting.
+ */
+bool key_available() {
+  return buffer_count != 0;
+}
+
+/**
+ * Read one character from the keyboard buffer. If the keyboard buffer is empty the running process
+ * blocks until a key is pressed, leaving the CPU to other processes or to halt. Nothing is echoed; the
+ * terminal layer does that. Must be called with the kernel lock held.
  *
  * \returns the next character input from the keyboard
  */
 char kgetc() {
-  while (buffer_count == 0) {}
+  wait_queue_wait(&key_waiters, key_available);
   char result = key_buffer[buffer_read++];
   buffer_read %= BUFFER_SIZE; // Reset the position if needed
-  buffer_count--;
-  kprint_c(result); // Print the obtained character to get getline and read to print input
+  // The keyboard interrupt may be adding a key on another CPU at the same time
+  __atomic_fetch_sub(&buffer_count, 1, __ATOMIC_SEQ_CST);
   return result;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Converts a scan code into a character based on scan code set 1. 
@@ -11,8 +12,26 @@
 void handle_press(uint8_t key_code);
 
 /**
- * Read one character from the keyboard buffer. If the keyboard buffer is empty this function will
- * block until a key is pressed.
+ * Adds a character to an externally maintained circular buffer of characters, and wakes the processes
+ * waiting for one. Only called from interrupt handlers on the bootstrap processor, so there is one writer
+ * at a time.
+ *
+ * \param key Character to add to the buffer.
+ * \returns The key that was added.
+ */
+char add_to_buffer(uint8_t key);
+
+/**
+ * Checks if a character is waiting in the keyboard buffer, so kgetc would return without blocking.
+ *
+ * \returns true if a character is waiting.
+ */
+bool key_available();
+
+/**
+ * Read one character from the keyboard buffer. If the keyboard buffer is empty the running process
+ * blocks until a key is pressed, leaving the CPU to other processes or to halt. Nothing is echoed; the
+ * terminal layer does that. Must be called with the kernel lock held.
  *
  * \returns the next character input from the keyboard
  */
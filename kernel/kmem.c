@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "kmem.h"
+#include "kprint.h"
+#include "boot.h"
+#include "page.h"
+
+// Marks the header of a slab or large allocation so kfree can reject pointers it didn't hand out
+#define SLAB_MAGIC 0x51AB51AB
+
+// Objects smaller than this are only aligned to the size of a pointer
+#define MIN_OBJECT_SIZE 16
+
+// Slabs get more pages until they hold at least this many objects
+#define MIN_OBJECTS_PER_SLAB 8
+#define MAX_SLAB_ORDER 3
+
+// The number of kmalloc size classes (16, 32, ..., KMALLOC_MAX_CACHE_SIZE)
+#define KMALLOC_NUM_CACHES 7
+
+// A free object. The node is stored in the object itself.
+typedef struct free_object {
+  struct free_object* next;
+} free_object_t;
+
+// The header at the start of every slab. Large kmalloc allocations use the same header with a NULL cache.
+typedef struct slab {
+  uint32_t magic;
+  uint8_t order;
+  uint16_t in_use;
+  kmem_cache_t* cache;
+  struct slab* next;
+  struct slab* prev;
+  free_object_t* free;
+} __attribute__((aligned(CACHE_LINE_SIZE))) slab_t;
+
+struct kmem_cache {
+  const char* name;
+  // The size of each object, including padding for alignment
+  size_t size;
+  // The order of the blocks used for slabs
+  uint8_t order;
+  // The number of objects that fit in a slab
+  uint16_t objects_per_slab;
+  // Slabs with at least one free object
+  slab_t* partial;
+  // Slabs with no free objects
+  slab_t* full;
+  // The number of slabs with no objects in use. One is kept around to avoid thrashing.
+  uint16_t num_empty;
+  uint64_t num_slabs;
+  uint64_t num_objects;
+  struct kmem_cache* next;
+};
+
+// The cache that kmem_cache_t structs are allocated from
+kmem_cache_t cache_cache;
+
+// Every cache, for debugging output
+kmem_cache_t* caches = NULL;
+
+// The kmalloc size-class caches, smallest first
+kmem_cache_t* kmalloc_caches[KMALLOC_NUM_CACHES];
+
+/**
+ * Adds a slab to the front of a list.
+ * \param list The list to add to.
+ * \param slab The slab to add.
+ */
+static void slab_list_push(slab_t** list, slab_t* slab) {
+  slab->prev = NULL;
+  slab->next = *list;
+  if (slab->next != NULL) slab->next->prev = slab;
+  *list = slab;
+}
+
+/**
+ * Removes a slab from a list.
+ * \param list The list to remove from.
+ * \param slab The slab to remove.
+ */
+static void slab_list_remove(slab_t** list, slab_t* slab) {
+  if (slab->prev != NULL) slab->prev->next = slab->next;
+  else *list = slab->next;
+  if (slab->next != NULL) slab->next->prev = slab->prev;
+}
+
+/**
+ * Fills in the fields of a cache and chooses its slab size.
+ * \param cache The cache to set up.
+ * \param name The name of the cache.
+ * \param size The size of each object.
+ * \param align The alignment of each object, a power of two.
+ * \param max_order The largest order to use for the cache's slabs.
+ * \returns true on success, or false if the objects are too large for a slab.
+ */
+static bool kmem_cache_setup(kmem_cache_t* cache, const char* name, size_t size, size_t align, uint8_t max_order) {
+  // Objects have to be able to hold a free list node
+  if (size < MIN_OBJECT_SIZE) size = MIN_OBJECT_SIZE;
+  // Objects of a cache line or more start on a cache line unless asked for something stricter
+  if (align == 0) align = (size >= CACHE_LINE_SIZE ? CACHE_LINE_SIZE : sizeof(void*));
+  size = (size + align - 1) & ~(align - 1);
+  if (align > sizeof(slab_t)) return false;
+
+  // Pick the smallest slab that holds enough objects
+  uint8_t order = 0;
+  while (order < max_order && ((PAGE_SIZE << order) - sizeof(slab_t)) / size < MIN_OBJECTS_PER_SLAB) {
+    order++;
+  }
+  if ((PAGE_SIZE << order) - sizeof(slab_t) < size) return false;
+
+  cache->name = name;
+  cache->size = size;
+  cache->order = order;
+  cache->objects_per_slab = ((PAGE_SIZE << order) - sizeof(slab_t)) / size;
+  cache->partial = NULL;
+  cache->full = NULL;
+  cache->num_empty = 0;
+  cache->num_slabs = 0;
+  cache->num_objects = 0;
+
+  cache->next = caches;
+  caches = cache;
+  return true;
+}
+
+/**
+ * Allocates a new slab for a cache and threads all of its objects onto the slab's free list.
+ * \param cache The cache to grow.
+ * \returns The new slab, or NULL if physical memory ran out.
+ */
+static slab_t* kmem_cache_grow(kmem_cache_t* cache) {
+  uintptr_t p = pmem_alloc_order(cache->order);
+  if (p == 0) return NULL;
+
+  slab_t* slab = phys_to_vir((void*) p);
+  slab->magic = SLAB_MAGIC;
+  slab->order = cache->order;
+  slab->in_use = 0;
+  slab->cache = cache;
+  slab->free = NULL;
+
+  // Objects start right after the header. Build the free list backwards so allocation goes in address order.
+  uintptr_t first = (uintptr_t) slab + sizeof(slab_t);
+  for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+    free_object_t* obj = (free_object_t*) (first + i * cache->size);
+    obj->next = slab->free;
+    slab->free = obj;
+  }
+
+  slab_list_push(&cache->partial, slab);
+  cache->num_empty++;
+  cache->num_slabs++;
+  return slab;
+}
+
+/**
+ * Initializes the kernel object allocator and the kmalloc size-class caches.
+ * Must be called after the physical memory allocator is initialized.
+ */
+void kmem_init() {
+  kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, MAX_SLAB_ORDER);
+
+  static const char* names[KMALLOC_NUM_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+  };
+  size_t size = MIN_OBJECT_SIZE;
+  for (int i = 0; i < KMALLOC_NUM_CACHES; i++) {
+    // kmalloc caches use single-page slabs so kfree can find an object's slab from its page
+    kmem_cache_t* cache = kmem_cache_alloc(&cache_cache);
+    kmem_cache_setup(cache, names[i], size, 0, 0);
+    kmalloc_caches[i] = cache;
+    size *= 2;
+  }
+}
+
+/**
+ * Creates a cache for objects of a fixed size. Objects are carved from slabs of physical memory.
+ * \param name A name for the cache, used for debugging output.
+ * \param size The size of each object in bytes.
+ * \param align The required alignment of each object. Must be a power of two, or 0 for the default.
+ * \returns A pointer to the new cache, or NULL on error.
+ */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align) {
+  // Alignment must be a power of two
+  if ((align & (align - 1)) != 0) return NULL;
+
+  kmem_cache_t* cache = kmem_cache_alloc(&cache_cache);
+  if (cache == NULL) return NULL;
+  if (!kmem_cache_setup(cache, name, size, align, MAX_SLAB_ORDER)) {
+    kmem_cache_free(&cache_cache, cache);
+    return NULL;
+  }
+  return cache;
+}
+
+/**
+ * Allocates an object from a cache.
+ * \param cache The cache to allocate from.
+ * \returns A pointer to the object, or NULL if memory ran out.
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+  slab_t* slab = cache->partial;
+  if (slab == NULL) {
+    slab = kmem_cache_grow(cache);
+    if (slab == NULL) return NULL;
+  }
+
+  // Take the first free object
+  free_object_t* obj = slab->free;
+  slab->free = obj->next;
+  if (slab->in_use == 0) cache->num_empty--;
+  slab->in_use++;
+  cache->num_objects++;
+
+  // Move the slab to the full list once every object is in use
+  if (slab->free == NULL) {
+    slab_list_remove(&cache->partial, slab);
+    slab_list_push(&cache->full, slab);
+  }
+  return obj;
+}
+
+/**
+ * Returns an object to the cache it was allocated from.
+ * \param cache The cache the object was allocated from.
+ * \param obj The object to free.
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+  if (obj == NULL) return;
+
+  // Slabs are naturally aligned blocks, so the header is found by rounding down to the slab size
+  slab_t* slab = (slab_t*) ((uintptr_t) obj & ~((PAGE_SIZE << cache->order) - 1));
+  if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+    kprintf("kmem_cache_free: %p does not belong to cache %s\n", obj, cache->name);
+    return;
+  }
+
+  // A slab on the full list gets a free object again
+  if (slab->free == NULL) {
+    slab_list_remove(&cache->full, slab);
+    slab_list_push(&cache->partial, slab);
+  }
+
+  free_object_t* node = obj;
+  node->next = slab->free;
+  slab->free = node;
+  slab->in_use--;
+  cache->num_objects--;
+
+  // Return empty slabs to the physical memory allocator, keeping one around for the next allocation
+  if (slab->in_use == 0) {
+    if (cache->num_empty > 0) {
+      slab_list_remove(&cache->partial, slab);
+      slab->magic = 0;
+      cache->num_slabs--;
+      pmem_free_order((uintptr_t) vir_to_phys(slab), slab->order);
+    } else {
+      cache->num_empty++;
+    }
+  }
+}
+
+/**
+ * Allocates kernel memory. Sizes up to KMALLOC_MAX_CACHE_SIZE come from power-of-two caches;
+ * larger sizes are backed by whole pages.
+ * \param size The number of bytes to allocate.
+ * \returns A pointer to the allocated memory, or NULL on error or if size is bigger than the largest block.
+ */
+void* kmalloc(size_t size) {
+  if (size == 0) return NULL;
+
+  // Use the smallest size class that fits
+  if (size <= KMALLOC_MAX_CACHE_SIZE) {
+    int index = 0;
+    while ((MIN_OBJECT_SIZE << index) < size) index++;
+    return kmem_cache_alloc(kmalloc_caches[index]);
+  }
+
+  // Large allocations get a block of pages, with a header in front of the returned memory
+  uint8_t order = 0;
+  while (order < PMEM_MAX_ORDER && (PAGE_SIZE << order) - sizeof(slab_t) < size) order++;
+  // Even the largest block is too small
+  if ((PAGE_SIZE << order) - sizeof(slab_t) < size) return NULL;
+  uintptr_t p = pmem_alloc_order(order);
+  if (p == 0) return NULL;
+
+  slab_t* header = phys_to_vir((void*) p);
+  header->magic = SLAB_MAGIC;
+  header->order = order;
+  header->cache = NULL;
+  return (void*) ((uintptr_t) header + sizeof(slab_t));
+}
+
+/**
+ * Frees memory returned by kmalloc.
+ * \param ptr The pointer to free. Freeing NULL does nothing.
+ */
+void kfree(void* ptr) {
+  if (ptr == NULL) return;
+
+  // kmalloc caches use single-page slabs and large allocations start one header into their first page,
+  // so the header is always at the start of the page holding ptr
+  slab_t* header = (slab_t*) ((uintptr_t) ptr & ~(PAGE_SIZE - 1));
+  if (header->magic != SLAB_MAGIC) {
+    kprintf("kfree: attempted to free %p, which was not allocated by kmalloc\n", ptr);
+    return;
+  }
+
+  if (header->cache != NULL) {
+    kmem_cache_free(header->cache, ptr);
+  } else {
+    header->magic = 0;
+    pmem_free_order((uintptr_t) vir_to_phys(header), header->order);
+  }
+}
+
+/**
+ * Prints the number of slabs and objects in use for every cache. For debugging.
+ */
+void kmem_print_stats() {
+  for (kmem_cache_t* cache = caches; cache != NULL; cache = cache->next) {
+    kprintf("%s: %lu objects of %lu bytes in %lu slabs\n", cache->name, cache->num_objects, cache->size, cache->num_slabs);
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Objects from kmalloc and object caches are at least aligned to this many bytes when they are this size or larger
+#define CACHE_LINE_SIZE 64
+
+// The largest size served from the kmalloc caches. Larger requests get whole pages.
+#define KMALLOC_MAX_CACHE_SIZE 1024
+
+// A cache of equally-sized kernel objects
+typedef struct kmem_cache kmem_cache_t;
+
+/**
+ * Initializes the kernel object allocator and the kmalloc size-class caches.
+ * Must be called after the physical memory allocator is initialized.
+ */
+void kmem_init();
+
+/**
+ * Creates a cache for objects of a fixed size. Objects are carved from slabs of physical memory.
+ * \param name A name for the cache, used for debugging output.
+ * \param size The size of each object in bytes.
+ * \param align The required alignment of each object. Must be a power of two, or 0 for the default.
+ * \returns A pointer to the new cache, or NULL on error.
+ */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align);
+
+/**
+ * Allocates an object from a cache.
+ * \param cache The cache to allocate from.
+ * \returns A pointer to the object, or NULL if memory ran out.
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/**
+ * Returns an object to the cache it was allocated from.
+ * \param cache The cache the object was allocated from.
+ * \param obj The object to free.
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/**
+ * Allocates kernel memory. Sizes up to KMALLOC_MAX_CACHE_SIZE come from power-of-two caches;
+ * larger sizes are backed by whole pages.
+ * \param size The number of bytes to allocate.
+ * \returns A pointer to the allocated memory, or NULL on error or if size is bigger than the largest block.
+ */
+void* kmalloc(size_t size);
+
+/**
+ * Frees memory returned by kmalloc.
+ * \param ptr The pointer to free. Freeing NULL does nothing.
+ */
+void kfree(void* ptr);
+
+/**
+ * Prints the number of slabs and objects in use for every cache. For debugging.
+ */
+void kmem_print_stats();
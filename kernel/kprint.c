@@ -1,11 +1,15 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "kprint.h"
 #include "strlib.h"
 #include "boot.h"
 #include "port.h"
+#include "serial.h"
+#include "log.h"
+#include "spinlock.h"
 
 // The term_ functions and the following definitions were provided by Professor Curtsinger.
 #define VGA_BUFFER 0xB8000
@@ -39,6 +43,16 @@ typedef struct vga_entry {
 // A pointer to the VGA buffer
 vga_entry_t* term;
 
+// The terminal's contents, kept in ordinary memory and copied to the VGA buffer by term_flush. The rows
+// form a ring starting at term_top, so scrolling moves term_top rather than copying every row.
+static vga_entry_t term_shadow[VGA_HEIGHT][VGA_WIDTH];
+static size_t term_top = 0;
+
+// Bit n is set when screen row n changed since the last flush, and TERM_CURSOR_DIRTY when the cursor moved
+#define TERM_CURSOR_DIRTY (1U << 31)
+#define TERM_ALL_DIRTY (((1U << VGA_HEIGHT) - 1) | TERM_CURSOR_DIRTY)
+static uint32_t term_dirty = 0;
+
 // The current cursor position in the terminal
 size_t term_col = 0;
 size_t term_row = 0;
@@ -64,19 +78,46 @@ void term_update_cursor() {
   outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
 }
 
+// Get the shadow buffer's cells for a row on the screen
+static vga_entry_t* term_line(size_t row) {
+  return term_shadow[(term_top + row) % VGA_HEIGHT];
+}
+
+// Record that parts of the screen need to be copied to the VGA buffer
+static void term_mark(uint32_t dirty) {
+  __atomic_fetch_or(&term_dirty, dirty, __ATOMIC_RELEASE);
+}
+
+// Fill a row of the shadow buffer with blanks
+static void term_blank(vga_entry_t* line) {
+  for (size_t i = 0; i < VGA_WIDTH; i++) {
+    line[i] = (vga_entry_t) {.c = ' ', .fg = VGA_COLOR_WHITE, .bg = VGA_COLOR_BLACK};
+  }
+}
+
 // Clear the terminal
 void term_clear() {
   // Clear the terminal
-  for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-    term[i].c = ' ';
-    term[i].bg = VGA_COLOR_BLACK;
-    term[i].fg = VGA_COLOR_WHITE;
-  }
+  for (size_t row = 0; row < VGA_HEIGHT; row++) term_blank(term_shadow[row]);
 
+  term_top = 0;
   term_col = 0;
   term_row = 0;
 
-  term_update_cursor();
+  term_mark(TERM_ALL_DIRTY);
+}
+
+// Shift the terminal up a row, clearing the last row
+static void term_scroll() {
+  // The old top row becomes the new bottom row
+  term_top = (term_top + 1) % VGA_HEIGHT;
+  term_row--;
+
+  // Clear the last row
+  term_blank(term_line(term_row));
+
+  // Every row on the screen moved
+  term_mark(TERM_ALL_DIRTY);
 }
 
 // Write one character to the terminal
@@ -84,15 +125,15 @@ void term_putchar(char c) {
   // Handle characters that do not consume extra space (no scrolling necessary)
   if (c == '\r') {
     term_col = 0;
-    term_update_cursor();
+    term_mark(TERM_CURSOR_DIRTY);
     return;
 
   } else if (c == '\b') {
     if (term_col > 0) {
       term_col--;
-      term[term_row * VGA_WIDTH + term_col].c = ' ';
+      term_line(term_row)[term_col].c = ' ';
     }
-    term_update_cursor();
+    term_mark((1U << term_row) | TERM_CURSOR_DIRTY);
     return;
   }
 
@@ -109,30 +150,62 @@ void term_putchar(char c) {
   }
 
   // Scroll if needed
-  if (term_row == VGA_HEIGHT) {
-    // Shift characters up a row
-    memcpy(term, &term[VGA_WIDTH], sizeof(vga_entry_t) * VGA_WIDTH * (VGA_HEIGHT - 1));
-    term_row--;
-    
-    // Clear the last row
-    for (size_t i=0; i<VGA_WIDTH; i++) {
-      size_t index = i + term_row * VGA_WIDTH;
-      term[index].c = ' ';
-      term[index].fg = VGA_COLOR_WHITE;
-      term[index].bg = VGA_COLOR_BLACK;
-    }
-  }
+  if (term_row == VGA_HEIGHT) term_scroll();
 
   // Write the character, unless it's a newline
   if (c != '\n') {
-    size_t index = term_col + term_row * VGA_WIDTH;
-    term[index].c = c;
-    term[index].fg = VGA_COLOR_WHITE;
-    term[index].bg = VGA_COLOR_BLACK;
+    term_line(term_row)[term_col] = (vga_entry_t) {.c = c, .fg = VGA_COLOR_WHITE, .bg = VGA_COLOR_BLACK};
     term_col++;
   }
+  term_mark((1U << term_row) | TERM_CURSOR_DIRTY);
+}
 
-  term_update_cursor();
+// Characters that move the cursor rather than being written to the terminal
+static bool term_is_control(char c) {
+  return c == '\n' || c == '\r' || c == '\b';
+}
+
+/** Writes a buffer of characters to the terminal. Runs of ordinary characters are copied into the
+* shadow buffer a row at a time; the screen catches up at the next term_flush.
+* \param buf The characters to write.
+* \param len The number of characters to write.
+*/
+void term_write(const char* buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (term_is_control(buf[i])) {
+      term_putchar(buf[i++]);
+      continue;
+    }
+
+    // Wrap and scroll if needed, like term_put
+    if (term_col == VGA_WIDTH) {
+      term_col = 0;
+      term_row++;
+    }
+    if (term_row == VGA_HEIGHT) term_scroll();
+
+    // Copy characters until the end of the row or the next control character
+    vga_entry_t* cell = &term_line(term_row)[term_col];
+    while (i < len && term_col < VGA_WIDTH && !term_is_control(buf[i])) {
+      *cell++ = (vga_entry_t) {.c = buf[i++], .fg = VGA_COLOR_WHITE, .bg = VGA_COLOR_BLACK};
+      term_col++;
+    }
+    term_mark((1U << term_row) | TERM_CURSOR_DIRTY);
+  }
+}
+
+/** Copies the rows of the terminal that changed since the last flush to the VGA buffer, and moves the
+* hardware cursor if it moved. Called on every timer tick, so the slow writes to video memory and the
+* cursor's ports happen at most once per tick however much is printed.
+*/
+void term_flush() {
+  // Rows changed while copying are marked again, so the next flush picks them up
+  uint32_t dirty = __atomic_exchange_n(&term_dirty, 0, __ATOMIC_ACQUIRE);
+  for (size_t row = 0; row < VGA_HEIGHT; row++) {
+    if (dirty & (1U << row)) memcpy(&term[row * VGA_WIDTH], term_line(row), sizeof(vga_entry_t) * VGA_WIDTH);
+  }
+  if (dirty & TERM_CURSOR_DIRTY) term_update_cursor();
 }
 
 // Initialize the terminal
@@ -142,90 +215,128 @@ void term_init() {
 
   term_enable_cursor();
   term_clear();
+  term_flush();
 }
 
-/** Prints a character on the terminal. Kernel version.
-* \param c The character to print.
-*/
-void kprint_c(char c) {
-  term_putchar(c);
-}
+// Where console output goes, and the lock that keeps writes to the terminal from different CPUs from mixing
+static uint8_t console_sinks = CONSOLE_VGA;
+static spinlock_t console_lock;
+
+// The most characters console_write draws with interrupts off
+#define CONSOLE_CHUNK 256
 
-/** Prints a string on the terminal. Kernel version.
-* \param str The string to print.
+// Set by console_panic. The terminal is then only drawn to if the lock is free.
+static volatile bool console_panicked = false;
+
+/** Checks if a word of the kernel command line is a given option.
+* \param word The start of the word.
+* \param len The length of the word.
+* \param option The option, such as "console=vga".
+* \returns true if the word is the option.
 */
-void kprint_s(const char* str) {
-  int length = stringlen(str);
-  for (int i = 0; i < length; i++) term_putchar(str[i]);
+static bool console_option(const char* word, size_t len, const char* option) {
+  if (len != stringlen(option)) return false;
+  for (size_t i = 0; i < len; i++) {
+    if (word[i] != option[i]) return false;
+  }
+  return true;
 }
 
-/*inspiration to use number % base in kprint_d and kprint_x
-https://programmerall.com/article/50851418599/
+/** Picks where console output goes from the kernel command line. Each console=vga or console=serial
+* option adds a place; without any, output only goes to the VGA text buffer. The serial console also
+* takes input. Must be called after the PICs are initialized.
+* \param cmdline The kernel command line, or NULL if there is none.
 */
-/** Prints an unsigned integer on the terminal. Kernel version.
-* \param value The unsigned integer to print.
-*/
-void kprint_d(uint64_t value){
-  char arr[20];
-  int counter = 0;
-  for (size_t i = 19; i >= 0; i--) {
-    int currentPlace = value%10;
-    arr[i] = currentPlace;
-    value = value/10;
-    if (value == 0){
-      counter = i;
-      break;
-    }
-  }
+void console_init(const char* cmdline) {
+  uint8_t sinks = 0;
+  const char* word = cmdline;
+  while (word != NULL && *word != '\0') {
+    // Find the next word separated by spaces
+    while (*word == ' ') word++;
+    size_t len = 0;
+    while (word[len] != '\0' && word[len] != ' ') len++;
 
-  for(size_t i = counter; i < 20; i++) {
-      if (arr[i] >= 0 && arr[i] <= 9) {
-      kprint_c(48 + arr[i]);
+    if (console_option(word, len, "console=vga")) {
+      sinks |= CONSOLE_VGA;
+    } else if (console_option(word, len, "console=serial") || console_option(word, len, "console=ttyS0")) {
+      sinks |= CONSOLE_SERIAL;
     }
+    word += len;
   }
+  if (sinks == 0) sinks = CONSOLE_VGA;
+
+  // Without a UART, keep the output somewhere it can be seen
+  bool serial_missing = (sinks & CONSOLE_SERIAL) && !serial_init();
+  if (serial_missing) sinks = CONSOLE_VGA;
+  console_sinks = sinks;
+  if (serial_missing) kprintf("No serial port found; using the VGA console.\n");
 }
 
-/** Prints an unsigned integer in hexadecimal on the terminal. Kernel version.
-* \param value The unsigned integer to print.
+/** Writes characters to every console selected by console_init. The terminal is drawn to CONSOLE_CHUNK
+* characters at a time, with interrupts back on in between, and the serial port has its own lock, so
+* buf should be kernel memory: copy user buffers first.
+* \param buf The characters to write.
+* \param len The number of characters to write.
 */
-void kprint_x(uint64_t value){
-  char arr[20];
-  int counter = 0;
-  for (size_t i = 19; i >= 0; i--) {
-    int currentPlace = value%16;
-    arr[i] = currentPlace;
-    value = value/16;
-    if (value == 0){
-      counter = i;
-      break;
+void console_write(const char* buf, size_t len) {
+  if (console_sinks & CONSOLE_VGA) {
+    for (size_t i = 0; i < len; i += CONSOLE_CHUNK) {
+      size_t chunk = len - i > CONSOLE_CHUNK ? CONSOLE_CHUNK : len - i;
+      if (console_panicked) {
+        // The CPU that panicked may have stopped while holding the lock
+        if (!spin_trylock(&console_lock)) break;
+        term_write(&buf[i], chunk);
+        spin_unlock(&console_lock);
+      } else {
+        uint64_t flags = spin_lock_irqsave(&console_lock);
+        term_write(&buf[i], chunk);
+        spin_unlock_irqrestore(&console_lock, flags);
+      }
     }
   }
+  if (console_sinks & CONSOLE_SERIAL) serial_write(buf, len);
+}
 
-  for(size_t i = counter; i < 20; i++) {
-      if (arr[i] >= 0 && arr[i] <= 9) {
-      kprint_c(48 + arr[i]);
-    } else {
-      kprint_c(87 + arr[i]);
-    }
-  }
+/** Gets the consoles ready for the kernel to halt: console_write stops waiting on locks a stopped CPU
+* might hold, and the serial port is written to directly.
+*/
+void console_panic() {
+  console_panicked = true;
+  serial_panic();
 }
 
-/** Prints a pointer on the terminal. Kernel version.
-* \param value The pointer to print.
+/** Prints a character on the terminal. Kernel version.
+* \param c The character to print.
 */
-void kprint_p(void* ptr) {
-  uint64_t value = (uint64_t) ptr;
-  kprint_s("0x");
-  kprint_x(value);
+void kprint_c(char c) {
+  console_write(&c, 1);
 }
 
-/** Prints a formatted string on the terminal. Supported format specifiers include:
-* %c: char : character
-* %d: uint64_t : unsigned 64-bit integer
-* %s: const char* : string
-* %x: uint64_t : unsigned 64-bit integer in hexadecimal
-* %p void* : pointer
-* Instances of these in format are replaced by the next variadic argument.
+/** Adds a formatted message to the kernel log. Supports the same format specifiers as kprintf.
+* \param level The message's level, such as LOG_INFO.
+* \param format the string to format. Replaces format specifiers with the arguments in args.
+* \param args The arguments to format.
+*/
+void vklog(uint8_t level, const char* format, va_list args) {
+  char buf[KPRINT_MAX];
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+  log_append(level, buf, len);
+}
+
+/** Adds a formatted message to the kernel log. Supports the same format specifiers as kprintf.
+* \param level The message's level, such as LOG_INFO.
+* \param format the string to format. Replaces format specifiers with next variadic argument.
+*/
+void klog(uint8_t level, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vklog(level, format, args);
+  va_end(args);
+}
+
+/** Prints a formatted string on the terminal. See vsnprintf in the stdlib for the supported conversions.
+* The message goes to the kernel log at LOG_INFO, and reaches the terminal the next time the log is flushed.
 * Kernel version.
 * \param format the string to format. Replaces format specifiers with next variadic argument.
 */
@@ -233,43 +344,7 @@ void kprintf(const char* format, ...) {
   // Start processing variadic arguments
   va_list args;
   va_start(args, format);
-
-  // Loop until we reach the end of the format string
-  size_t index = 0;
-  while (format[index] != '\0') {
-    // Is the current charater a '%'?
-    if (format[index] == '%') {
-      // Yes, print the argument
-      index++;
-      switch(format[index]) {
-        case '%':
-          kprint_c('%');
-          break;
-        case 'c':
-          kprint_c(va_arg(args, int));
-          break;
-        case 's':
-          kprint_s(va_arg(args, char*));
-          break;
-        case 'd':
-          kprint_d(va_arg(args, uint64_t));
-          break;
-        case 'x':
-          kprint_x(va_arg(args, int64_t));
-          break;
-        case 'p':
-          kprint_p(va_arg(args, void*));
-          break;
-        default:
-          kprint_s("<not supported>");
-      }
-    } else {
-      // No, just a normal character. Print it.
-      kprint_c(format[index]);
-    }
-    index++;
-  }
-
+  vklog(LOG_INFO, format, args);
   // Finish handling variadic arguments
   va_end(args);
-}
\ No newline at end of file
+}
@@ -1,23 +1,72 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <log_entry.h>
+
+// The longest message kprintf formats; anything past this is cut off
+#define KPRINT_MAX 256
+
+// Places console output can go, chosen with the console= boot option
+#define CONSOLE_VGA 0x1
+#define CONSOLE_SERIAL 0x2
 
 // Initializes the terminal.
 void term_init();
 
+/** Picks where console output goes from the kernel command line. Each console=vga or console=serial
+* option adds a place; without any, output only goes to the VGA text buffer. The serial console also
+* takes input. Must be called after the PICs are initialized.
+* \param cmdline The kernel command line, or NULL if there is none.
+*/
+void console_init(const char* cmdline);
+
+/** Writes characters to every console selected by console_init. The terminal is drawn to CONSOLE_CHUNK
+* characters at a time, with interrupts back on in between, and the serial port has its own lock, so
+* buf should be kernel memory: copy user buffers first.
+* \param buf The characters to write.
+* \param len The number of characters to write.
+*/
+void console_write(const char* buf, size_t len);
+
+/** Gets the consoles ready for the kernel to halt: console_write stops waiting on locks a stopped CPU
+* might hold, and the serial port is written to directly.
+*/
+void console_panic();
+
+/** Writes a buffer of characters to the terminal, moving the hardware cursor once at the end.
+* \param buf The characters to write.
+* \param len The number of characters to write.
+*/
+void term_write(const char* buf, size_t len);
+
+/** Copies the rows of the terminal that changed since the last flush to the VGA buffer, and moves the
+* hardware cursor if it moved. Output only reaches the screen when this runs, which is on every timer tick.
+*/
+void term_flush();
+
 /** Prints a character on the terminal. Kernel version.
 * \param c The character to print.
 */
 void kprint_c(char c);
 
-/** Prints a formatted string on the terminal. Supported format specifiers include:
-* %c: char : character
-* %d: uint64_t : unsigned 64-bit integer
-* %s: const char* : string
-* %x: uint64_t : unsigned 64-bit integer in hexadecimal
-* %p void* : pointer
-* Instances of these in format are replaced by the next variadic argument.
+/** Adds a formatted message to the kernel log. Supports the same format specifiers as kprintf.
+* \param level The message's level, such as LOG_INFO.
+* \param format the string to format. Replaces format specifiers with the arguments in args.
+* \param args The arguments to format.
+*/
+void vklog(uint8_t level, const char* format, va_list args);
+
+/** Adds a formatted message to the kernel log. Supports the same format specifiers as kprintf.
+* \param level The message's level, such as LOG_INFO.
+* \param format the string to format. Replaces format specifiers with next variadic argument.
+*/
+void klog(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/** Prints a formatted string on the terminal. See vsnprintf in the stdlib for the supported conversions.
+* The message goes to the kernel log at LOG_INFO, and reaches the terminal the next time the log is flushed.
 * Kernel version.
 * \param format the string to format. Replaces format specifiers with next variadic argument.
 */
-void kprintf(const char* format, ...);
+void kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
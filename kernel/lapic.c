@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#include "lapic.h"
+#include "cpu.h"
+#include "pit.h"
+#include "boot.h"
+
+// Local APIC registers, as offsets from its base address
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+// Spurious interrupt vector register bit that enables the local APIC
+#define LAPIC_SVR_ENABLE 0x100
+// Timer register bit that reloads the count every time it reaches 0
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+// Divide configuration value that divides the timer's clock by 16
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+// The number of PIT ticks the calibration runs for
+#define LAPIC_CALIBRATE_TICKS 10
+
+// The initial count that makes the timer fire at the calibrated rate
+uint32_t lapic_timer_count = 0;
+
+/**
+ * Gets a pointer to a local APIC register. Every CPU finds its own local APIC at the same physical address,
+ * which the higher half direct map covers.
+ * \param reg The register's offset.
+ * \returns A pointer to the register.
+ */
+static volatile uint32_t* lapic_reg(uint32_t reg) {
+  uintptr_t base = rdmsr(MSR_APIC_BASE) & 0xFFFFF000;
+  return (volatile uint32_t*) phys_to_vir((void*) (base + reg));
+}
+
+/**
+ * Enables the running CPU's local APIC.
+ */
+void lapic_init() {
+  *lapic_reg(LAPIC_SVR) = LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_INTERRUPT;
+}
+
+/**
+ * Measures how fast the local APIC timer counts against the PIT. Must be called on the bootstrap
+ * processor with interrupts enabled, after the PIT is started.
+ * \param hz How often lapic_timer_start should make the timer fire.
+ */
+void lapic_timer_calibrate(uint32_t hz) {
+  *lapic_reg(LAPIC_TIMER_DIVIDE) = LAPIC_TIMER_DIVIDE_16;
+
+  // Let the timer count down from its maximum over a whole number of PIT ticks
+  uint64_t start = pit_ticks();
+  while (pit_ticks() == start) __asm__ volatile("hlt");
+  *lapic_reg(LAPIC_TIMER_INITIAL) = 0xFFFFFFFF;
+  while (pit_ticks() < start + 1 + LAPIC_CALIBRATE_TICKS) __asm__ volatile("hlt");
+  uint32_t elapsed = 0xFFFFFFFF - *lapic_reg(LAPIC_TIMER_CURRENT);
+  *lapic_reg(LAPIC_TIMER_INITIAL) = 0;
+
+  lapic_timer_count = (uint64_t) elapsed * TIMER_HZ / LAPIC_CALIBRATE_TICKS / hz;
+}
+
+/**
+ * Starts the running CPU's local APIC timer, firing at the rate given to lapic_timer_calibrate.
+ */
+void lapic_timer_start() {
+  *lapic_reg(LAPIC_TIMER_DIVIDE) = LAPIC_TIMER_DIVIDE_16;
+  *lapic_reg(LAPIC_LVT_TIMER) = LAPIC_TIMER_PERIODIC | LAPIC_TIMER_INTERRUPT;
+  *lapic_reg(LAPIC_TIMER_INITIAL) = lapic_timer_count;
+}
+
+/**
+ * Tells the running CPU's local APIC that an interrupt has been handled.
+ */
+void lapic_eoi() {
+  *lapic_reg(LAPIC_EOI) = 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Interrupt numbers for the local APIC. The spurious vector's low four bits must be set.
+#define LAPIC_TIMER_INTERRUPT 0x30
+#define LAPIC_SPURIOUS_INTERRUPT 0xFF
+
+/**
+ * Enables the running CPU's local APIC.
+ */
+void lapic_init();
+
+/**
+ * Measures how fast the local APIC timer counts against the PIT. Must be called on the bootstrap
+ * processor with interrupts enabled, after the PIT is started.
+ * \param hz How often lapic_timer_start should make the timer fire.
+ */
+void lapic_timer_calibrate(uint32_t hz);
+
+/**
+ * Starts the running CPU's local APIC timer, firing at the rate given to lapic_timer_calibrate.
+ */
+void lapic_timer_start();
+
+/**
+ * Tells the running CPU's local APIC that an interrupt has been handled.
+ */
+void lapic_eoi();
@@ -7,18 +7,20 @@
 #include "page.h"
 #include "stivale2.h"
 #include "loader.h"
-#include "gdt.h"
-#include "usermode_entry.h"
+#include "clock.h"
+#include "process.h"
 
 /**
- * Loads an ELF file from the kernel modules. 
+ * Loads an ELF file from the kernel modules into a process's address space, along with a user-mode stack.
+ * The running address space is switched back in before returning.
  *
  * \param mod_name The name of the module to load.
  * \param modules_tag A pointer to the stivale2 modules structure.
- * \returns -1 if the requested file was not found, -2 if the file was not executable, 
+ * \param proc The process to load into. Its entry point and user stack pointer are filled in.
+ * \returns 0 on success, -1 if the requested file was not found, -2 if the file was not executable,
  * or -3 if the memory allocation failed.
  */
-int32_t run_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules_tag) {
+int32_t load_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules_tag, process_t* proc) {
   // Get the number of modules
   uint16_t count = modules_tag->module_count;
   struct stivale2_module* current;
@@ -41,20 +43,25 @@ int32_t run_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules
       return -1;
     }
   }
-  unmap_lower_half(read_cr3() & 0xFFFFFFFFFFFFF000);
   // Make sure the file is executable
   if (elf_hdr->e_type != ET_EXEC) {
     //kprintf("Load error: attempted to execute non-executable ELF file\n");
     return -2;
   }
   
+  // Segments are copied through their user addresses, so run in the new address space while loading
+  uintptr_t old_cr3 = read_cr3();
+  uintptr_t root = proc->root;
+  vm_switch(root, proc->pcid);
+  int32_t rc = 0;
+
   // Loop over the program table entries and allocate memory for loadable segments
-  for (int i = 0; i < phnum; i++) {
+  for (int i = 0; i < phnum; i++, elf_phdr++) {
     if (elf_phdr->p_type == PT_LOAD) {
       // Skip NULL sections
       if (elf_phdr->p_vaddr == 0x0) continue;
       
-      // Allocate the segment's requested memory; if it is larger than a page, call vm_map enough times to accomodate the requested chunk
+      // Allocate the segment's requested memory
       int64_t size_left = elf_phdr->p_memsz;
       uint64_t vaddr_to_map;
       // If the requested location is not page aligned, set the address to map to the start of the page
@@ -65,39 +72,51 @@ int32_t run_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules
       } else {
         vaddr_to_map = elf_phdr->p_vaddr;
       }
-      int i = 0;
-      do {
-        // Allocate a requested page, setting permissions to writable only for byte copying
-        if (vm_map(read_cr3(), vaddr_to_map + (i * PAGE_SIZE), 0, 1, 1) == false) {
-          //kprintf("Load error: failed to allocate memory for requested page %p\n", elf_phdr->p_vaddr);
-          return -3;
-        }
-        size_left -= PAGE_SIZE;
-        i++;
-      } while (size_left > 0);
+      uintptr_t segment_end = (vaddr_to_map + size_left + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+      // Allocate the requested pages, setting permissions to writable only for byte copying.
+      // Parts of the segment that cover whole 2 MiB regions get a single large page each; the rest uses 4 KiB pages.
+      uintptr_t large_start = (vaddr_to_map + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+      uintptr_t large_end = segment_end & ~(PAGE_SIZE_2M - 1);
+      if (large_start >= large_end) {
+        large_start = segment_end;
+        large_end = segment_end;
+      }
+      if (vm_map_range(root, vaddr_to_map, large_start - vaddr_to_map, 0, 1, 1) == false) {
+        //kprintf("Load error: failed to allocate memory for requested page %p\n", elf_phdr->p_vaddr);
+        rc = -3;
+        break;
+      }
+      for (uintptr_t p = large_start; p < large_end && rc == 0; p += PAGE_SIZE_2M) {
+        if (vm_map_large(root, p, PAGE_SIZE_2M, 0, 1, 1) == false) rc = -3;
+      }
+      if (rc != 0 || vm_map_range(root, large_end, segment_end - large_end, 0, 1, 1) == false) {
+        rc = -3;
+        break;
+      }
 
       // Copy the segment's data into the requested area
       memcpy((void*)elf_phdr->p_vaddr, (const void*) ((uintptr_t) elf_hdr + (uintptr_t) elf_phdr->p_offset), elf_phdr->p_filesz);
       
-      // Change the permissions to those requested by the file.
-      vm_protect(read_cr3(), elf_phdr->p_vaddr, 1, ((elf_phdr->p_flags & 0x2) >> 1), ~(elf_phdr->p_flags & 0x1) & 0x1);
+      // Change the permissions of the whole segment to those requested by the file.
+      vm_protect_range(root, vaddr_to_map, segment_end - vaddr_to_map, 1, ((elf_phdr->p_flags & 0x2) >> 1), ~(elf_phdr->p_flags & 0x1) & 0x1);
     }
-    elf_phdr++;
   }
   // Pick an arbitrary location and size for the user-mode stack
   uintptr_t user_stack = 0x70000000000;
   size_t user_stack_size = 8 * PAGE_SIZE;
 
-  // Map the user-mode-stack
-  for(uintptr_t p = user_stack; p < user_stack + user_stack_size; p += 0x1000) {
-    // Map a page that is user-accessible, writable, but not executable
-    vm_map(read_cr3() & 0xFFFFFFFFFFFFF000, p, true, true, false);
-  }
+  // Map the user-mode stack as user-accessible, writable, but not executable
+  if (rc == 0 && !vm_map_range(root, user_stack, user_stack_size, true, true, false)) rc = -3;
 
-  // And now jump to the entry point
-  usermode_entry(USER_DATA_SELECTOR | 0x3,            // User data selector with priv=3
-                  user_stack + user_stack_size - 8,   // Stack starts at the high address minus 8 bytes
-                  USER_CODE_SELECTOR | 0x3,           // User code selector with priv=3
-                  elf_hdr->e_entry);                  // Jump to the entry point specified in the ELF file
-  return 1;
-  }
+  // Map the page the stdlib reads the clock from
+  if (rc == 0 && !clock_map(root)) rc = -3;
+
+  // Go back to the caller's address space. Anything mapped so far is freed with the process on error.
+  vm_switch(old_cr3, old_cr3 & 0xFFF);
+
+  // The process starts at the entry point specified in the ELF file, with the stack starting at the high address minus 8 bytes
+  proc->entry = elf_hdr->e_entry;
+  proc->user_sp = user_stack + user_stack_size - 8;
+  return rc;
+}
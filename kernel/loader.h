@@ -2,15 +2,18 @@
 
 #include "stivale2.h"
 #include "boot.h"
+#include "process.h"
 
 #define PAGE_SIZE 0x1000
 
 /**
- * Loads an ELF file from the kernel modules. 
+ * Loads an ELF file from the kernel modules into a process's address space, along with a user-mode stack.
+ * The running address space is switched back in before returning.
  *
  * \param mod_name The name of the module to load.
  * \param modules_tag A pointer to the stivale2 modules structure.
- * \returns -1 if the requested file was not found, -2 if the file was not executable, 
+ * \param proc The process to load into. Its entry point and user stack pointer are filled in.
+ * \returns 0 on success, -1 if the requested file was not found, -2 if the file was not executable,
  * or -3 if the memory allocation failed.
  */
-int32_t run_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules_tag);
+int32_t load_exec_elf(char* mod_name, struct stivale2_struct_tag_modules* modules_tag, process_t* proc);
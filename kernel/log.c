@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <strlib.h>
+
+#include "log.h"
+#include "kprint.h"
+#include "cpu.h"
+#include "smp.h"
+#include "spinlock.h"
+
+// A place in the ring. commit is 0 while the entry is being written, then the entry's sequence number
+// plus one, so a reader can tell a finished entry from one that is being written or was overwritten.
+typedef struct log_slot {
+  volatile uint64_t commit;
+  log_entry_t entry;
+} log_slot_t;
+
+// Entry n goes in slot n % LOG_ENTRIES. Writers claim sequence numbers from log_head without a lock.
+static log_slot_t log_ring[LOG_ENTRIES];
+static uint64_t log_head = 0;
+
+// The next entry log_flush writes to the console, and the lock that keeps one CPU flushing at a time
+static uint64_t log_tail = 0;
+static spinlock_t log_flush_lock;
+
+/**
+ * Adds a message to the kernel log. Never waits, so it is safe to call from interrupt handlers on any CPU.
+ * The message reaches the console the next time log_flush runs.
+ * \param level The message's level, such as LOG_INFO.
+ * \param text The message.
+ * \param len The number of characters in the message.
+ */
+void log_append(uint8_t level, const char* text, size_t len) {
+  uint64_t tsc = rdtsc();
+  uint8_t cpu = this_cpu()->id;
+  do {
+    size_t chunk = len < LOG_TEXT_SIZE ? len : LOG_TEXT_SIZE;
+    uint64_t seq = __atomic_fetch_add(&log_head, 1, __ATOMIC_RELAXED);
+    log_slot_t* slot = &log_ring[seq % LOG_ENTRIES];
+
+    // Readers that catch the slot being rewritten see commit change and skip it
+    __atomic_store_n(&slot->commit, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->entry.seq = seq;
+    slot->entry.tsc = tsc;
+    slot->entry.level = level;
+    slot->entry.cpu = cpu;
+    slot->entry.len = chunk;
+    memcpy(slot->entry.text, text, chunk);
+    __atomic_store_n(&slot->commit, seq + 1, __ATOMIC_RELEASE);
+
+    text += chunk;
+    len -= chunk;
+  } while (len > 0);
+}
+
+/**
+ * Copies an entry out of the ring.
+ * \param seq The entry's sequence number.
+ * \param entry Filled in with the entry.
+ * \returns The slot's commit value: seq + 1 if the entry was copied, anything less if it isn't finished
+ * yet, or anything more if it was overwritten.
+ */
+static uint64_t log_copy(uint64_t seq, log_entry_t* entry) {
+  log_slot_t* slot = &log_ring[seq % LOG_ENTRIES];
+  uint64_t commit = __atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE);
+  if (commit != seq + 1) return commit;
+  *entry = slot->entry;
+
+  // A writer that claimed the slot while we copied it leaves commit changed
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&slot->commit, __ATOMIC_RELAXED);
+}
+
+/**
+ * Writes the messages logged since the last flush to the console, oldest first. Called on every timer
+ * tick with LOG_FLUSH_ENTRIES, so a burst of messages is printed over several ticks rather than all in
+ * one interrupt. Returns right away if another CPU is already flushing.
+ * \param max The most entries to write.
+ */
+void log_flush(size_t max) {
+  if (!spin_trylock(&log_flush_lock)) return;
+
+  // Skip entries that were overwritten before they could be printed
+  uint64_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+  if (head - log_tail > LOG_ENTRIES) log_tail = head - LOG_ENTRIES;
+
+  log_entry_t entry;
+  for (size_t written = 0; log_tail != head && written < max; written++) {
+    uint64_t commit = log_copy(log_tail, &entry);
+    // Stop at an entry that is still being written; the next flush picks it up
+    if (commit < log_tail + 1) break;
+    if (commit == log_tail + 1) console_write(entry.text, entry.len);
+    log_tail++;
+  }
+
+  spin_unlock(&log_flush_lock);
+}
+
+/**
+ * Copies the newest entries in the kernel log, oldest first.
+ * \param buf The array to copy to.
+ * \param count The number of entries buf has room for.
+ * \returns The number of entries copied.
+ */
+size_t log_read(log_entry_t* buf, size_t count) {
+  uint64_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+  if (count > LOG_ENTRIES) count = LOG_ENTRIES;
+  uint64_t seq = head > count ? head - count : 0;
+
+  // Entries that are being written or were overwritten meanwhile are left out
+  size_t copied = 0;
+  for (; seq != head; seq++) {
+    if (log_copy(seq, &buf[copied]) == seq + 1) copied++;
+  }
+  return copied;
+}
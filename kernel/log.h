@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <log_entry.h>
+
+// The number of entries the kernel log keeps. Older entries are overwritten.
+#define LOG_ENTRIES 1024
+
+// The most entries the timer interrupt writes to the console each tick
+#define LOG_FLUSH_ENTRIES 16
+
+/**
+ * Adds a message to the kernel log. Never waits, so it is safe to call from interrupt handlers on any CPU.
+ * The message reaches the console the next time log_flush runs.
+ * \param level The message's level, such as LOG_INFO.
+ * \param text The message.
+ * \param len The number of characters in the message.
+ */
+void log_append(uint8_t level, const char* text, size_t len);
+
+/**
+ * Writes the messages logged since the last flush to the console, oldest first. Called on every timer
+ * tick with LOG_FLUSH_ENTRIES, so a burst of messages is printed over several ticks rather than all in
+ * one interrupt. Returns right away if another CPU is already flushing.
+ * \param max The most entries to write.
+ */
+void log_flush(size_t max);
+
+/**
+ * Copies the newest entries in the kernel log, oldest first.
+ * \param buf The array to copy to.
+ * \param count The number of entries buf has room for.
+ * \returns The number of entries copied.
+ */
+size_t log_read(log_entry_t* buf, size_t count);
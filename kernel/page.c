@@ -5,13 +5,59 @@
 #include "boot.h"
 #include "strlib.h"
 #include "page.h"
+#include "cpu.h"
+#include "smp.h"
 
-typedef struct freelist_node {
-  struct freelist_node* next;
-} freelist_node_t;
+// A free block of physical memory in the buddy allocator. The node lives in the first page of
+// the block itself and is accessed through the higher half direct map.
+typedef struct free_block {
+  struct free_block* next;
+  struct free_block* prev;
+  uint8_t order;
+} free_block_t;
 
-// Freelist of physical addresses
-freelist_node_t* top = NULL;
+// Free lists of the buddy allocator, one for each block order
+free_block_t* free_lists[PMEM_MAX_ORDER + 1];
+// The number of blocks on each free list
+uint64_t free_counts[PMEM_MAX_ORDER + 1];
+
+// Bitmap with one bit per physical page. A bit is set when its page is the first page of a free block.
+uint64_t* free_map = NULL;
+// The range of physical addresses covered by free_map
+uintptr_t pmem_base = 0;
+uintptr_t pmem_end = 0;
+// The number of extra address spaces sharing each page, indexed like free_map. Pages with a count of
+// zero have a single owner; only the first page of a large block is used.
+uint16_t* share_counts = NULL;
+
+// Is CR4.PCIDE set, so CR3 carries a process-context identifier?
+bool pcid_enabled = false;
+// Can the invpcid instruction be used?
+bool invpcid_supported = false;
+// The next process-context identifier to hand out. PCID 0 belongs to the kernel's own address space.
+uint16_t next_pcid = 1;
+// The number of times the PCIDs have run out and started over. Each CPU flushes its TLB once per round.
+uint64_t pcid_generation = 0;
+
+// Pages that have already been zeroed, ready to be handed out by pmem_alloc_zeroed
+uintptr_t zero_pool[ZERO_POOL_SIZE];
+uint16_t zero_pool_count = 0;
+// The number of pmem_alloc_zeroed calls served from the pool, and the number that had to zero a page themselves
+uint64_t zero_pool_hits = 0;
+uint64_t zero_pool_misses = 0;
+
+// A range of usable physical memory from the bootloader's memory map. Pages between next and end
+// have never been handed to the buddy allocator and are split off lazily when the free lists run dry.
+typedef struct pmem_range {
+  uintptr_t next;
+  uintptr_t end;
+} pmem_range_t;
+
+// The usable ranges of physical memory
+pmem_range_t pmem_ranges[PMEM_MAX_RANGES];
+uint16_t pmem_num_ranges = 0;
+// The first range that may still have pages that were never handed out
+uint16_t pmem_next_range = 0;
 
 // This struct matches the layout of a page table entry.
 typedef struct page_table_entry {
@@ -23,7 +69,10 @@ typedef struct page_table_entry {
   bool accessed : 1;
   bool dirty : 1;
   bool page_size : 1;
-  uint8_t _unused0 : 4;
+  bool global : 1;
+  // Available to software: marks a page that is shared read-only after fork and copied on the next write
+  bool cow : 1;
+  uint8_t _unused0 : 2;
   uintptr_t address : 40;
   uint16_t _unused1 : 11;
   bool no_execute : 1;
@@ -45,6 +94,15 @@ void write_cr0(uint64_t value) {
   __asm__("mov %0, %%cr0" : : "r" (value));
 }
 
+/** Reads the value of the cr2 register, which holds the address that caused the last page fault.
+* \returns The value of the cr2 register.
+*/
+uintptr_t read_cr2() {
+  uintptr_t value;
+  __asm__("mov %%cr2, %0" : "=r" (value));
+  return value;
+}
+
 /**
  * Obtain a pointer to the top-level page structure.
  * \returns a pointer to the top-level page structure.
@@ -62,6 +120,22 @@ void write_cr3(uint64_t value) {
   __asm__("mov %0, %%cr3" : : "r" (value));
 }
 
+/** Reads the value of the cr4 register.
+* \returns The value of the cr4 register.
+*/
+uint64_t read_cr4() {
+  uintptr_t value;
+  __asm__("mov %%cr4, %0" : "=r" (value));
+  return value;
+}
+
+/** Writes a value to the cr4 register.
+* \param value The value to write
+*/
+void write_cr4(uint64_t value) {
+  __asm__("mov %0, %%cr4" : : "r" (value));
+}
+
 /**
  * Updates a virtual address translation in the translation lookaside buffer.
  *
@@ -116,8 +190,171 @@ void unmap_lower_half(uintptr_t root) {
     }
   }
 
-  // Reload CR3 to flush any cached address translations
-  write_cr3(read_cr3());
+  // Switch to a fresh PCID so the new contents of the lower half start with no cached translations.
+  // Kernel mappings are global, so they stay in the TLB either way.
+  vm_switch(root, vm_pcid_alloc());
+}
+
+/**
+ * Frees a page table and everything it maps, including the pages and large pages at the leaves.
+ * \param table The page table to free
+ * \param level The level of the table (1 for a table of 4 KiB pages)
+ */
+static void vm_free_table(pt_entry_t* table, int level) {
+  for (size_t i = 0; i < 512; i++) {
+    if (!table[i].present) continue;
+    uintptr_t p = (uintptr_t) table[i].address << 12;
+    if (level == 1) {
+      pmem_free(p);
+    } else if (table[i].page_size) {
+      // A large page is one block of order 9 (2 MiB) or 18 (1 GiB)
+      pmem_free_order(p, (level - 1) * 9);
+    } else {
+      vm_free_table((pt_entry_t*) phys_to_vir((void*) p), level - 1);
+      pmem_free(p);
+    }
+  }
+}
+
+/**
+ * Frees every page mapped in the lower half of an address space, along with the tables that map them.
+ * Unlike unmap_lower_half, the mapped pages are assumed to belong to the address space. The address space
+ * must not be running.
+ * \param root The physical address of the top-level page table structure
+ */
+void vm_free_user(uintptr_t root) {
+  pt_entry_t* l4_table = (pt_entry_t*) phys_to_vir((void*) (root & 0xFFFFFFFFFFFFF000));
+  for (size_t l4_index = 0; l4_index < 256; l4_index++) {
+    if (!l4_table[l4_index].present) continue;
+    uintptr_t p = (uintptr_t) l4_table[l4_index].address << 12;
+    vm_free_table((pt_entry_t*) phys_to_vir((void*) p), 3);
+    pmem_free(p);
+    l4_table[l4_index].present = 0;
+  }
+}
+
+/**
+ * Invalidates TLB entries with the invpcid instruction.
+ * \param type INVPCID_SINGLE_CONTEXT to drop the non-global entries of one PCID, or INVPCID_ALL_NON_GLOBAL for every PCID
+ * \param pcid The PCID to invalidate for INVPCID_SINGLE_CONTEXT
+ */
+static void invpcid(uint64_t type, uint16_t pcid) {
+  struct {
+    uint64_t pcid;
+    uint64_t address;
+  } descriptor = { pcid, 0 };
+  __asm__ volatile("invpcid %0, %1" :: "m" (descriptor), "r" (type) : "memory");
+}
+
+/**
+ * Marks every leaf mapping below a page table as global, so it survives CR3 reloads.
+ * \param table The page table to start at
+ * \param level The level of the table (4 for the top-level table)
+ * \param first The first entry of the table to process
+ */
+static void vm_mark_global(pt_entry_t* table, int level, int first) {
+  for (int i = first; i < 512; i++) {
+    if (table[i].present == 0) continue;
+    if (level == 1 || (level < 4 && table[i].page_size)) {
+      table[i].global = 1;
+    } else {
+      vm_mark_global((pt_entry_t*) phys_to_vir((void*) (uintptr_t) (table[i].address << 12)), level - 1, 0);
+    }
+  }
+}
+
+/**
+ * Sets up the TLB features that avoid flushing kernel translations. The kernel's higher half mappings are
+ * marked global, then vm_init_cpu_tlb turns on global pages and PCIDs for the bootstrap processor.
+ * Must be called once the lower half of the kernel's address space has been unmapped.
+ * \param root The physical address of the kernel's top-level page table structure
+ */
+void vm_init_tlb(uintptr_t root) {
+  if (cpu_has_pge()) {
+    vm_mark_global((pt_entry_t*) phys_to_vir((void*) (root & 0xFFFFFFFFFFFFF000)), 4, 256);
+  }
+  // PCIDs can only be turned on while the current PCID is 0
+  pcid_enabled = cpu_has_pcid() && (read_cr3() & 0xFFF) == 0;
+  invpcid_supported = pcid_enabled && cpu_has_invpcid();
+  vm_init_cpu_tlb();
+}
+
+/**
+ * Turns on global pages (CR4.PGE) and PCIDs (CR4.PCIDE) for the running CPU, when they are supported.
+ * Every CPU must call this after vm_init_tlb has run on the bootstrap processor.
+ */
+void vm_init_cpu_tlb() {
+  // Setting CR4.PGE flushes the TLB, so the global bits take effect right away
+  if (cpu_has_pge()) write_cr4(read_cr4() | CR4_PGE);
+
+  if (pcid_enabled) write_cr4(read_cr4() | CR4_PCIDE);
+}
+
+/**
+ * Drops the non-global cached translations of every PCID on the running CPU, and records that its TLB
+ * is clean for the current round of PCIDs.
+ */
+static void vm_flush_all_pcids() {
+  if (invpcid_supported) {
+    invpcid(INVPCID_ALL_NON_GLOBAL, 0);
+  } else {
+    // Toggling CR4.PGE flushes the entries of every PCID
+    uint64_t cr4 = read_cr4();
+    write_cr4(cr4 & ~CR4_PGE);
+    write_cr4(cr4);
+  }
+  this_cpu()->pcid_generation = pcid_generation;
+}
+
+/**
+ * Hands out a process-context identifier for a new address space. Each PCID is handed out once per
+ * round; when they run out, stale translations for every PCID are flushed before starting over.
+ * \returns A PCID that has no cached translations.
+ */
+uint16_t vm_pcid_alloc() {
+  if (!pcid_enabled) return 0;
+
+  if (next_pcid > MAX_PCID) {
+    next_pcid = 1;
+    // Other CPUs flush the next time they switch address spaces
+    pcid_generation++;
+    vm_flush_all_pcids();
+  }
+  return next_pcid++;
+}
+
+/**
+ * Switches to an address space. With PCIDs, the translations cached for the new address space are kept.
+ * \param root The physical address of the top-level page table structure
+ * \param pcid The PCID of the address space, from vm_pcid_alloc
+ */
+void vm_switch(uintptr_t root, uint16_t pcid) {
+  root &= 0xFFFFFFFFFFFFF000;
+  if (pcid_enabled) {
+    // PCIDs handed out again since this CPU last flushed may still have another address space's entries
+    if (this_cpu()->pcid_generation != pcid_generation) vm_flush_all_pcids();
+    write_cr3(root | pcid | CR3_NOFLUSH);
+  } else {
+    write_cr3(root);
+  }
+}
+
+/**
+ * Drops all non-global cached translations for an address space, such as after its mappings were torn down.
+ * \param pcid The PCID of the address space
+ */
+void vm_flush_pcid(uint16_t pcid) {
+  if (invpcid_supported) {
+    invpcid(INVPCID_SINGLE_CONTEXT, pcid);
+  } else if (!pcid_enabled || (read_cr3() & 0xFFF) == pcid) {
+    // Reloading CR3 without the no-flush bit drops the current PCID's entries
+    write_cr3(read_cr3());
+  } else {
+    // Without invpcid, another PCID's entries can only be dropped by flushing everything
+    uint64_t cr4 = read_cr4();
+    write_cr4(cr4 & ~CR4_PGE);
+    write_cr4(cr4);
+  }
 }
 
 // This function was provided by Professor Curtsinger.
@@ -151,7 +388,7 @@ void translate(void* address) {
     // Get the section of the address for the current level.
     uint16_t index = indices[i];
     // Print the levels information.
-    kprintf("table[index] at %p: %p\n", &table[index], table[index]);
+    kprintf("table[index] at %p: %lx\n", &table[index], *(uint64_t*) &table[index]);
     if (table[index].present == 1) {
       kprintf("%s", table[index].user ? "user" : "kernel");
       if (table[index].writable == 1) {
@@ -164,7 +401,13 @@ void translate(void* address) {
 
       // Progress to the next level.
       table_phys = table[index].address << 12;
-      kprintf(" %p\n", table_phys);
+      kprintf(" %p\n", (void*) table_phys);
+      // A large page ends the walk early. The rest of the address is an offset into the large page.
+      if (i < 4 && table[index].page_size) {
+        uintptr_t offset = addr & ((PAGE_SIZE << ((i - 1) * 9)) - 1);
+        kprintf("%p maps to %p (large page)\n", address, (void*) (table_phys + offset));
+        return;
+      }
       table = (pt_entry_t*)phys_to_vir((void*)table_phys);
     } else {
       kprintf("  not present\n");
@@ -172,82 +415,414 @@ void translate(void* address) {
     }
   }
   // Print the final mapping.
-  kprintf("%p maps to %p\n", address, (table_phys + indices[0]));
+  kprintf("%p maps to %p\n", address, (void*) (table_phys + indices[0]));
+}
+
+/**
+ * Converts a physical address to its index in free_map.
+ * \param p The physical address to convert.
+ * \returns The index of the page containing p.
+ */
+static inline uint64_t pmem_index(uintptr_t p) {
+  return (p - pmem_base) / PAGE_SIZE;
 }
 
 /**
- * Initializes the system's freelist. 
- * Takes an array of memory sections and adds all the pages in that section to the freelist.
+ * Checks if the block of a given order at a physical address is on a free list.
+ * \param p The physical address of the block.
+ * \param order The order of the block.
+ * \returns true if the block is free, false otherwise.
+ */
+static bool pmem_block_is_free(uintptr_t p, uint8_t order) {
+  // Blocks outside of the tracked range are never free
+  if (p < pmem_base || p >= pmem_end) return false;
+  uint64_t index = pmem_index(p);
+  if ((free_map[index / 64] & (1UL << (index % 64))) == 0) return false;
+  // The page starts a free block, but it must also be the same size to be a buddy
+  free_block_t* block = phys_to_vir((void*) p);
+  return block->order == order;
+}
+
+/**
+ * Adds a block to the free list for its order.
+ * \param p The physical address of the block.
+ * \param order The order of the block.
+ */
+static void pmem_push_block(uintptr_t p, uint8_t order) {
+  free_block_t* block = phys_to_vir((void*) p);
+  block->order = order;
+  block->prev = NULL;
+  block->next = free_lists[order];
+  if (block->next != NULL) block->next->prev = block;
+  free_lists[order] = block;
+  free_counts[order]++;
+
+  uint64_t index = pmem_index(p);
+  free_map[index / 64] |= 1UL << (index % 64);
+}
+
+/**
+ * Removes a block from the free list for its order.
+ * \param p The physical address of the block.
+ * \param order The order of the block.
+ */
+static void pmem_remove_block(uintptr_t p, uint8_t order) {
+  free_block_t* block = phys_to_vir((void*) p);
+  if (block->prev != NULL) block->prev->next = block->next;
+  else free_lists[order] = block->next;
+  if (block->next != NULL) block->next->prev = block->prev;
+  free_counts[order]--;
+
+  uint64_t index = pmem_index(p);
+  free_map[index / 64] &= ~(1UL << (index % 64));
+}
+
+/**
+ * Moves the next untouched block of physical memory from the usable ranges onto the free lists.
+ * The block is the largest aligned block that fits at the start of the remaining range.
+ * \returns true if a block was added, or false if all usable memory has already been handed out.
+ */
+static bool pmem_take_range() {
+  // Skip ranges that have been used up
+  while (pmem_next_range < pmem_num_ranges &&
+         pmem_ranges[pmem_next_range].next >= pmem_ranges[pmem_next_range].end) {
+    pmem_next_range++;
+  }
+  if (pmem_next_range == pmem_num_ranges) return false;
+
+  pmem_range_t* range = &pmem_ranges[pmem_next_range];
+
+  // Find the largest block that is aligned at the start of the range and fits in it
+  uint8_t order = 0;
+  while (order < PMEM_MAX_ORDER &&
+         (range->next & ((PAGE_SIZE << (order + 1)) - 1)) == 0 &&
+         range->next + (PAGE_SIZE << (order + 1)) <= range->end) {
+    order++;
+  }
+  // Pages are unshared when they enter the allocator, and stay that way whenever they are free
+  memset(&share_counts[pmem_index(range->next)], 0, sizeof(uint16_t) << order);
+
+  pmem_push_block(range->next, order);
+  range->next += PAGE_SIZE << order;
+  return true;
+}
+
+/**
+ * Initializes the system's physical memory allocator.
+ * Records the usable memory sections as ranges; pages are only handed to the buddy allocator's free lists
+ * when an allocation needs them, so no page is touched here. Space for the allocator's bitmap and the
+ * page share counts is taken from the first section large enough to hold them.
  *
- * \param start Pointer that is the start of the current memory section.
- * \param end Pointer that is the end of the current memory section.
+ * \param start Array of the start addresses of the memory sections.
+ * \param end Array of the end addresses of the memory sections.
  * \param num_sections The number of memory sections to process.
  */
 void freelist_init(uint64_t* start, uint64_t* end, uint16_t num_sections) {
-  uint64_t start_addr = *start;
-  uint64_t end_addr = *end;
-  // Loop until all memory sections are processed.
+  if (num_sections == 0) return;
+  if (num_sections > PMEM_MAX_RANGES) num_sections = PMEM_MAX_RANGES;
+
+  // Find the range of physical memory the bitmap has to cover
+  pmem_base = start[0] & ~(PAGE_SIZE - 1);
+  pmem_end = end[0];
+  for (int i = 1; i < num_sections; i++) {
+    if ((start[i] & ~(PAGE_SIZE - 1)) < pmem_base) pmem_base = start[i] & ~(PAGE_SIZE - 1);
+    if (end[i] > pmem_end) pmem_end = end[i];
+  }
+
+  // Reserve space for the bitmap and share counts at the start of the first section large enough to hold them.
+  // Share counts are cleared as pages are handed to the free lists.
+  uint64_t map_words = (pmem_index(pmem_end) + 63) / 64;
+  uint64_t map_size = (map_words * sizeof(uint64_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  uint64_t counts_size = (pmem_index(pmem_end) * sizeof(uint16_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
   for (int i = 0; i < num_sections; i++) {
-    // Loop until all chunks of the current section are processed.
-    while ((start_addr + PAGE_SIZE) <= end_addr) {
-      pmem_free(start_addr);
-      start_addr += PAGE_SIZE;
+    uint64_t section_start = (start[i] + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (section_start + map_size + counts_size <= end[i]) {
+      free_map = phys_to_vir((void*) section_start);
+      share_counts = phys_to_vir((void*) (section_start + map_size));
+      start[i] = section_start + map_size + counts_size;
+      break;
     }
-    // Increment the position in the start and end arrays.
-    start_addr = (uint64_t) start[i+1];
-    end_addr = (uint64_t) end[i+1];
+  }
+  if (free_map == NULL) {
+    kprintf("freelist_init: no room for the physical memory bitmap\n");
+    return;
+  }
+  // The bitmap holds one bit per page, so clearing it a word at a time is cheap even for large memory sizes
+  for (uint64_t i = 0; i < map_words; i++) free_map[i] = 0;
+
+  // Record the usable ranges. Only whole pages can be handed out.
+  for (int i = 0; i < num_sections; i++) {
+    uintptr_t range_start = (start[i] + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uintptr_t range_end = end[i] & ~(PAGE_SIZE - 1);
+    if (range_start >= range_end) continue;
+    pmem_ranges[pmem_num_ranges].next = range_start;
+    pmem_ranges[pmem_num_ranges].end = range_end;
+    pmem_num_ranges++;
   }
 }
 
+/**
+ * Allocate a physically contiguous block of 2^order pages.
+ * \param order The order of the block to allocate, at most PMEM_MAX_ORDER.
+ * \returns the physical address of the allocated block, aligned to its size, or 0 on error.
+ */
+uintptr_t pmem_alloc_order(uint8_t order) {
+  if (order > PMEM_MAX_ORDER) return 0;
+
+  // Find the smallest free block that is large enough, taking more memory from the usable ranges if needed
+  uint8_t current;
+  while (1) {
+    current = order;
+    while (current <= PMEM_MAX_ORDER && free_lists[current] == NULL) current++;
+    if (current <= PMEM_MAX_ORDER) break;
+    if (!pmem_take_range()) return 0;
+  }
+
+  uintptr_t p = (uintptr_t) vir_to_phys(free_lists[current]);
+  pmem_remove_block(p, current);
+
+  // Split the block, returning the upper halves to the free lists until it is the right size
+  while (current > order) {
+    current--;
+    pmem_push_block(p + (PAGE_SIZE << current), current);
+  }
+  return p;
+}
+
 /**
  * Allocate a page of physical memory.
  * \returns the physical address of the allocated physical memory or 0 on error.
  */
 uintptr_t pmem_alloc() {
-  if (top == NULL) return 0;
-  // Get a page from the top of the freelist. 
-  freelist_node_t* vtop = phys_to_vir((void*) top);
-  freelist_node_t* temp = top;
-  // Advance the freelist to the next entry.
-  top = vtop->next;
-  return (uintptr_t) temp;
+  // Fast path: take a single page straight off the order 0 free list
+  free_block_t* block = free_lists[0];
+  if (block == NULL) {
+    uintptr_t p = pmem_alloc_order(0);
+    // Fall back on the zeroed page pool when memory is otherwise exhausted
+    if (p == 0 && zero_pool_count > 0) p = zero_pool[--zero_pool_count];
+    return p;
+  }
+
+  free_lists[0] = block->next;
+  if (block->next != NULL) block->next->prev = NULL;
+  free_counts[0]--;
+
+  uintptr_t p = (uintptr_t) vir_to_phys(block);
+  uint64_t index = pmem_index(p);
+  free_map[index / 64] &= ~(1UL << (index % 64));
+  return p;
 }
 
 /**
- * Free a page of physical memory.
- * \param p is the physical address of the page to free, which must be page-aligned.
+ * Fills a block of 2^order pages with zeroes.
+ * \param p The physical address of the block.
+ * \param order The order of the block.
  */
-void pmem_free(uintptr_t p) {
+static void pmem_zero(uintptr_t p, uint8_t order) {
+  uint64_t count = (PAGE_SIZE << order) / sizeof(uint64_t);
+  void* dest = phys_to_vir((void*) p);
+  __asm__ volatile("rep stosq" : "+D" (dest), "+c" (count) : "a" (0) : "memory");
+}
+
+/**
+ * Allocate a page of physical memory that is filled with zeroes.
+ * Pages come from the pre-zeroed pool when it has any, so zeroing stays off the caller's path.
+ * \returns the physical address of the allocated physical memory or 0 on error.
+ */
+uintptr_t pmem_alloc_zeroed() {
+  if (zero_pool_count > 0) {
+    zero_pool_hits++;
+    return zero_pool[--zero_pool_count];
+  }
+
+  // The pool is empty, so zero a page now
+  zero_pool_misses++;
+  uintptr_t p = pmem_alloc();
+  if (p == 0) return 0;
+  pmem_zero(p, 0);
+  return p;
+}
+
+/**
+ * Zeroes one free page and adds it to the pre-zeroed pool. Meant to be called repeatedly when the CPU
+ * has nothing else to do, so it does a bounded amount of work per call.
+ * \returns true if a page was added, or false if the pool is full or memory is exhausted.
+ */
+bool pmem_zero_pool_refill() {
+  if (zero_pool_count == ZERO_POOL_SIZE) return false;
+  uintptr_t p = pmem_alloc();
+  if (p == 0) return false;
+  pmem_zero(p, 0);
+  zero_pool[zero_pool_count++] = p;
+  return true;
+}
+
+/**
+ * Reads the pre-zeroed pool's counters.
+ * \param hits Set to the number of pmem_alloc_zeroed calls served from the pool.
+ * \param misses Set to the number of pmem_alloc_zeroed calls that had to zero a page themselves.
+ */
+void pmem_zero_pool_stats(uint64_t* hits, uint64_t* misses) {
+  *hits = zero_pool_hits;
+  *misses = zero_pool_misses;
+}
+
+/**
+ * Records another owner for an allocated block, such as a page shared between address spaces after fork.
+ * Each extra owner must call pmem_free_order once before the block is actually freed.
+ * \param p The physical address of the block.
+ */
+void pmem_ref(uintptr_t p) {
+  share_counts[pmem_index(p)]++;
+}
+
+/**
+ * Checks if an allocated block has more than one owner.
+ * \param p The physical address of the block.
+ * \returns true if the block is shared.
+ */
+bool pmem_is_shared(uintptr_t p) {
+  return share_counts[pmem_index(p)] > 0;
+}
+
+/**
+ * Free a block of 2^order pages, merging it with its buddy blocks when they are free. If the block is
+ * shared, this only drops one owner.
+ * \param p is the physical address of the block to free, which must be aligned to the block size.
+ * \param order The order the block was allocated with.
+ */
+void pmem_free_order(uintptr_t p, uint8_t order) {
   // Don't free NULL
   if ((void*) p == NULL) {
     kprintf("pmem_free: attempted to free NULL\n");
     return;
   }
-  // Don't free a pointer that isn't page-aligned
-  if (p % PAGE_SIZE != 0) {
-    kprintf("pmem_free: attempted to free a pointer that is not page-aligned\n");
+  // Don't free a pointer that isn't aligned to the block size
+  if (order > PMEM_MAX_ORDER || p % (PAGE_SIZE << order) != 0) {
+    kprintf("pmem_free: attempted to free a pointer that is not aligned to its block size\n");
+    return;
+  }
+  // Don't free memory the allocator doesn't track
+  if (p < pmem_base || p + (PAGE_SIZE << order) > pmem_end) {
+    kprintf("pmem_free: attempted to free a pointer outside of usable memory\n");
+    return;
+  }
+  // Don't free a block twice
+  uint64_t index = pmem_index(p);
+  if (free_map[index / 64] & (1UL << (index % 64))) {
+    kprintf("pmem_free: attempted to free %p twice\n", (void*) p);
+    return;
+  }
+  // Shared blocks stay allocated until their last owner frees them
+  if (share_counts[index] > 0) {
+    share_counts[index]--;
     return;
   }
-  // Add the node to the freelist.
-  freelist_node_t* new_node = (freelist_node_t*) p;
-  freelist_node_t* vnew_node = phys_to_vir((void*) new_node);
-  vnew_node->next = top;
-  top = new_node;
+
+  // Merge with the buddy block as long as it is free
+  while (order < PMEM_MAX_ORDER) {
+    uintptr_t buddy = p ^ (PAGE_SIZE << order);
+    if (!pmem_block_is_free(buddy, order)) break;
+    pmem_remove_block(buddy, order);
+    if (buddy < p) p = buddy;
+    order++;
+  }
+  pmem_push_block(p, order);
+}
+
+/**
+ * Free a page of physical memory.
+ * \param p is the physical address of the page to free, which must be page-aligned.
+ */
+void pmem_free(uintptr_t p) {
+  pmem_free_order(p, 0);
+}
+
+/**
+ * Print the number of free blocks of each order and the total number of free pages. For debugging.
+ */
+void pmem_print_stats() {
+  uint64_t total = 0;
+  kprintf("Free blocks by order:");
+  for (int i = 0; i <= PMEM_MAX_ORDER; i++) {
+    kprintf(" %lu", free_counts[i]);
+    total += free_counts[i] << i;
+  }
+  uint64_t untouched = 0;
+  for (int i = 0; i < pmem_num_ranges; i++) {
+    if (pmem_ranges[i].next < pmem_ranges[i].end) {
+      untouched += (pmem_ranges[i].end - pmem_ranges[i].next) / PAGE_SIZE;
+    }
+  }
+  kprintf("\nFree pages: %lu (%lu not yet split off the usable ranges)\n", total + untouched, untouched);
+  kprintf("Zeroed pages: %d pooled, %lu hits, %lu misses\n", zero_pool_count, zero_pool_hits, zero_pool_misses);
 }
 
-// Print a specified number of elements of the freelist. For debugging. Broken, I think
+#ifdef PMEM_BENCHMARK
+// Build with -DPMEM_BENCHMARK to time the buddy allocator at boot. Each test uses up to
+// PMEM_BENCHMARK_BLOCKS blocks; the mixed test picks orders from 0 to PMEM_BENCHMARK_MAX_ORDER.
+#define PMEM_BENCHMARK_BLOCKS 4096
+#define PMEM_BENCHMARK_MAX_ORDER 4
+uintptr_t bench_blocks[PMEM_BENCHMARK_BLOCKS];
+uint8_t bench_orders[PMEM_BENCHMARK_BLOCKS];
+
+/**
+ * Times order 0 allocations and frees, the only kind the old freelist could do, then a mix of orders.
+ * The mixed blocks are freed in two passes, every other one first, with the free block counts printed
+ * after each pass to show how fragmented memory is and how much merging recovers.
+ */
+void pmem_benchmark() {
+  size_t count = 0;
+  uint64_t start = rdtsc();
+  while (count < PMEM_BENCHMARK_BLOCKS && (bench_blocks[count] = pmem_alloc()) != 0) count++;
+  uint64_t alloc_cycles = rdtsc() - start;
+  start = rdtsc();
+  for (size_t i = 0; i < count; i++) pmem_free(bench_blocks[i]);
+  uint64_t free_cycles = rdtsc() - start;
+  if (count == 0) return;
+  kprintf("pmem order 0: %lu cycles per alloc, %lu per free\n", alloc_cycles / count, free_cycles / count);
+
+  // A fixed seed, so every run asks for the same orders
+  uint64_t seed = 1;
+  count = 0;
+  start = rdtsc();
+  while (count < PMEM_BENCHMARK_BLOCKS) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    bench_orders[count] = (seed >> 33) % (PMEM_BENCHMARK_MAX_ORDER + 1);
+    bench_blocks[count] = pmem_alloc_order(bench_orders[count]);
+    if (bench_blocks[count] == 0) break;
+    count++;
+  }
+  alloc_cycles = rdtsc() - start;
+  if (count == 0) return;
+
+  start = rdtsc();
+  for (size_t i = 0; i < count; i += 2) pmem_free_order(bench_blocks[i], bench_orders[i]);
+  free_cycles = rdtsc() - start;
+  kprintf("pmem orders 0-%d: %lu cycles per alloc, %lu per free\n", PMEM_BENCHMARK_MAX_ORDER,
+          alloc_cycles / count, free_cycles / ((count + 1) / 2));
+  kprintf("With every other block freed:\n");
+  pmem_print_stats();
+
+  for (size_t i = 1; i < count; i += 2) pmem_free_order(bench_blocks[i], bench_orders[i]);
+  kprintf("With every block freed:\n");
+  pmem_print_stats();
+}
+#endif
+
+// Print a specified number of elements of the order 0 free list. For debugging.
 void print_freelist(int num_print) {
-  freelist_node_t* cursor = top;
-  for (int i = 0; i < num_print; i++) {
-    kprintf("%p ", cursor);
+  free_block_t* cursor = free_lists[0];
+  for (int i = 0; i < num_print && cursor != NULL; i++) {
+    kprintf("%p ", vir_to_phys(cursor));
     cursor = cursor->next;
   }
   kprintf("\n");
 }
 
-// Returns the first item on the freelist as a virtual address. Doesn't really have a purpose.
+// Returns the first item on the order 0 free list as a virtual address. Doesn't really have a purpose.
 uintptr_t peek_freelist() {
-  return (uintptr_t) phys_to_vir((void*) top);
+  return (uintptr_t) free_lists[0];
 }
 
 /**
@@ -278,16 +853,16 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
     uint16_t index = indices[i];
     // If the entry is present, move to the next level
     if (table[index].present == 1) {
+      // The address is already covered by a large page
+      if (i < 4 && table[index].page_size) return false;
       table_phys = table[index].address << 12;
       table = (pt_entry_t*) phys_to_vir((void*)table_phys);
     // Fill in the entry otherwise
     } else {
-      // Get a pointer to a new page
-      new_ptr = pmem_alloc();
-      // Return false if the call to pmem_alloc failed
+      // Get a pointer to a new, zeroed page
+      new_ptr = pmem_alloc_zeroed();
+      // Return false if the call to pmem_alloc_zeroed failed
       if (new_ptr == 0) return false;
-      // Zero out the new page
-      memset((void*) phys_to_vir((void*)new_ptr), 0, PAGE_SIZE);
       // Set values based on which level the table is
       table[index].present = 1;
       table[index].user = (i == 1 ? user : 1);
@@ -310,7 +885,80 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
 }
 
 /**
- * Unmap a page from a virtual address space
+ * Map a single large page of memory into a virtual address space. The page is backed by a
+ * physically contiguous block and filled with zeroes.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map into the address space, must be aligned to page_size
+ * \param page_size The size of the page, either PAGE_SIZE_2M or PAGE_SIZE_1G
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param executable Should the page be executable?
+ * \returns true if the mapping succeeded, or false if there was an error
+ */
+bool vm_map_large(uintptr_t root, uintptr_t address, uint64_t page_size, bool user, bool writable, bool executable) {
+  // Choose the level the page lives at and the size of the block backing it
+  int leaf_level;
+  if (page_size == PAGE_SIZE_2M) {
+    leaf_level = 2;
+  } else if (page_size == PAGE_SIZE_1G && cpu_has_1g_pages()) {
+    leaf_level = 3;
+  } else {
+    return false;
+  }
+  if (address % page_size != 0) return false;
+
+  uintptr_t table_phys = root & 0xFFFFFFFFFFFFF000;
+
+  uintptr_t addr = address;
+  uint16_t indices[] = {
+    addr & 0xFFF,
+    (addr >> 12) & 0x1FF,
+    (addr >> 21) & 0x1FF,
+    (addr >> 30) & 0x1FF,
+    (addr >> 39) & 0x1FF,
+  };
+
+  pt_entry_t* table = (pt_entry_t*) phys_to_vir((void*)table_phys);
+
+  // Walk down to the table that holds the large page, filling in missing tables on the way
+  for (int i = 4; i > leaf_level; i--) {
+    uint16_t index = indices[i];
+    if (table[index].present == 1) {
+      // The address is already covered by a larger page
+      if (i < 4 && table[index].page_size) return false;
+    } else {
+      uintptr_t new_ptr = pmem_alloc_zeroed();
+      if (new_ptr == 0) return false;
+      table[index].present = 1;
+      table[index].user = 1;
+      table[index].writable = 1;
+      table[index].no_execute = 0;
+      table[index].address = new_ptr >> 12;
+    }
+    table_phys = table[index].address << 12;
+    table = (pt_entry_t*) phys_to_vir((void*)table_phys);
+  }
+
+  // Fail if the entry is already a page or a table of smaller pages
+  uint16_t index = indices[leaf_level];
+  if (table[index].present == 1) return false;
+
+  uint8_t order = (leaf_level - 1) * 9;
+  uintptr_t block = pmem_alloc_order(order);
+  if (block == 0) return false;
+  pmem_zero(block, order);
+
+  table[index].present = 1;
+  table[index].page_size = 1;
+  table[index].user = user;
+  table[index].writable = writable;
+  table[index].no_execute = executable;
+  table[index].address = block >> 12;
+  return true;
+}
+
+/**
+ * Unmap a page from a virtual address space. If the address is part of a large page, the whole large page is unmapped.
  * \param root The physical address of the top-level page table structure
  * \param address The virtual address to unmap from the address space
  * \returns true if successful, or false if anything goes wrong
@@ -328,34 +976,31 @@ bool vm_unmap(uintptr_t root, uintptr_t address) {
   };
 
   pt_entry_t* table = (pt_entry_t*) phys_to_vir((void*)table_phys);
-  uint16_t index = 0;
-  pt_entry_t* to_free;
   // Traverse the page table.
   for (int i = 4; i > 0; i--) {
-    index = indices[i];
-    //kprintf("level: %d\n", i);
-    //kprintf("table[index].address in loop: %p\n", table[index].address);
+    uint16_t index = indices[i];
     // If the entry wasn't present, return false.
     if (table[index].present == 0) return false;
-    // If the current level is the lowest one, save it.
-    if (i == 1) to_free = table;
+    // The mapping ends at the lowest level, or at a large page in level 2 or 3
+    if (i == 1 || (i < 4 && table[index].page_size)) {
+      // Set the present bit to 0 to unmap it.
+      table[index].present = 0;
+      // Free the page, or the whole block backing a large page.
+      pmem_free_order((uintptr_t)(table[index].address << 12), (i - 1) * 9);
+      // Update the tlb.
+      invalidate_tlb(address);
+      return true;
+    }
     // Advance to the next level.
     table_phys = table[index].address << 12;
     table = (pt_entry_t*)phys_to_vir((void*)table_phys);
   }
-  // Set the present bit to 0 to unmap it.
-  to_free[index].present = 0;
-  //kprintf("to_free after traversal: %p\n", to_free);
-  //kprintf("table[index].address after traversal: %p\n", to_free[index].address);
-  // Free that address.
-  pmem_free((uintptr_t)(to_free[index].address << 12));
-  // Update the tlb.
-  invalidate_tlb((uintptr_t) phys_to_vir((void*) address));
-  return true;
+  return false;
 }
 
 /**
- * Change the protections for a page in a virtual address space
+ * Change the protections for a page in a virtual address space. If the address is part of a large page,
+ * the protections of the whole large page change.
  * \param root The physical address of the top-level page table structure
  * \param address The virtual address to update
  * \param user Should the page be user-accessible or kernel only?
@@ -376,23 +1021,390 @@ bool vm_protect(uintptr_t root, uintptr_t address, bool user, bool writable, boo
   };
 
   pt_entry_t* table = (pt_entry_t*) phys_to_vir((void*)table_phys);
-  uint16_t index;
 
   // Traverse the pages tables
   for (int i = 4; i > 0; i--) {
-    index = indices[i];
+    uint16_t index = indices[i];
     if (table[index].present == 0) return false;
 
-    // Set the requested permissions when the bottom level is reached
-    if (i == 1) {
+    // Set the requested permissions when the bottom level or a large page is reached
+    if (i == 1 || (i < 4 && table[index].page_size)) {
       table[index].user = user;
       table[index].writable = writable;
       table[index].no_execute = executable;
+      invalidate_tlb(address);
+      return true;
     }
     // Move to the next level.
     table_phys = table[index].address << 12;
     table = (pt_entry_t*)phys_to_vir((void*)table_phys);
   }
-  invalidate_tlb((uintptr_t) phys_to_vir((void*) address));
+  return false;
+}
+
+/**
+ * Finds the page table entry that maps an address.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to look up
+ * \param create Should missing page tables be allocated on the way down?
+ * \param level Set to the level of the returned entry: 1 for a 4 KiB page, or 2 or 3 for a large page.
+ *              If no entry is returned, set to the level of the entry that was not present.
+ * \returns A pointer to the entry, or NULL if a table on the way is missing and could not be created
+ */
+static pt_entry_t* vm_walk(uintptr_t root, uintptr_t address, bool create, int* level) {
+  pt_entry_t* table = (pt_entry_t*) phys_to_vir((void*) (root & 0xFFFFFFFFFFFFF000));
+
+  for (int i = 4; i > 1; i--) {
+    pt_entry_t* entry = &table[(address >> (12 + 9 * (i - 1))) & 0x1FF];
+    if (entry->present == 0) {
+      uintptr_t new_ptr = (create ? pmem_alloc_zeroed() : 0);
+      if (new_ptr == 0) {
+        *level = i;
+        return NULL;
+      }
+      entry->present = 1;
+      entry->user = 1;
+      entry->writable = 1;
+      entry->no_execute = 0;
+      entry->address = new_ptr >> 12;
+    } else if (i < 4 && entry->page_size) {
+      // A large page ends the walk early
+      *level = i;
+      return entry;
+    }
+    table = (pt_entry_t*) phys_to_vir((void*) (entry->address << 12));
+  }
+
+  *level = 1;
+  return &table[(address >> 12) & 0x1FF];
+}
+
+/**
+ * Removes cached translations for a range of addresses after their mappings changed. Small ranges are
+ * invalidated page by page; larger ones flush the whole TLB once.
+ * \param root The physical address of the top-level page table structure that was changed
+ * \param start The first address in the range, page-aligned
+ * \param end The address just past the range, page-aligned
+ */
+static void vm_flush_range(uintptr_t root, uintptr_t start, uintptr_t end) {
+  // Only the active address space can have cached translations
+  if ((root & 0xFFFFFFFFFFFFF000) != (read_cr3() & 0xFFFFFFFFFFFFF000)) return;
+
+  if ((end - start) / PAGE_SIZE > TLB_FLUSH_THRESHOLD) {
+    write_cr3(read_cr3());
+  } else {
+    for (uintptr_t p = start; p < end; p += PAGE_SIZE) {
+      invalidate_tlb(p);
+    }
+  }
+}
+
+/**
+ * Maps a page that is already allocated into a virtual address space, such as a page the kernel shares with
+ * every process. The page gets another owner, so freeing the address space only drops that owner.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map the page at, must be page-aligned
+ * \param page The physical address of the page
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param no_execute Should the page be non-executable?
+ * \returns true if the mapping succeeded, or false if the address is already mapped or memory ran out
+ */
+bool vm_map_shared(uintptr_t root, uintptr_t address, uintptr_t page, bool user, bool writable, bool no_execute) {
+  if (address % PAGE_SIZE != 0) return false;
+  int level;
+  pt_entry_t* entry = vm_walk(root, address, true, &level);
+  if (entry == NULL || level != 1 || entry->present) return false;
+
+  pmem_ref(page);
+  entry->present = 1;
+  entry->user = user;
+  entry->writable = writable;
+  entry->no_execute = no_execute;
+  entry->address = page >> 12;
   return true;
 }
+
+/**
+ * Map a range of memory into a virtual address space with 4 KiB pages. The page tables are walked
+ * once for every level 1 table the range touches, rather than once per page.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range, must be page-aligned
+ * \param length The length of the range in bytes. Rounded up to the next page.
+ * \param user Should the pages be user-accessible?
+ * \param writable Should the pages be writable?
+ * \param executable Should the pages be executable?
+ * \returns true if the mapping succeeded, or false if there was an error. Nothing is left mapped on error.
+ */
+bool vm_map_range(uintptr_t root, uintptr_t address, uint64_t length, bool user, bool writable, bool executable) {
+  if (address % PAGE_SIZE != 0) return false;
+  uintptr_t end = (address + length + PAGE_SIZE - 1) & 0xFFFFFFFFFFFFF000;
+
+  pt_entry_t* entry = NULL;
+  for (uintptr_t p = address; p < end; p += PAGE_SIZE) {
+    // Consecutive pages share a level 1 table until the range crosses into the next 2 MiB region
+    if (entry == NULL || p % PAGE_SIZE_2M == 0) {
+      int level;
+      entry = vm_walk(root, p, true, &level);
+      if (entry == NULL || level != 1) {
+        vm_unmap_range(root, address, p - address);
+        return false;
+      }
+    } else {
+      entry++;
+    }
+
+    // Fill in the entry, failing if the page is already mapped
+    uintptr_t page = (entry->present ? 0 : pmem_alloc_zeroed());
+    if (page == 0) {
+      vm_unmap_range(root, address, p - address);
+      return false;
+    }
+    entry->present = 1;
+    entry->user = user;
+    entry->writable = writable;
+    entry->no_execute = executable;
+    entry->address = page >> 12;
+  }
+  return true;
+}
+
+/**
+ * Unmap a range of memory from a virtual address space, freeing the pages that backed it. Large pages
+ * that overlap the range are unmapped completely. The TLB is flushed once for the whole range.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range
+ * \param length The length of the range in bytes
+ * \returns true if every page in the range was mapped, or false if some were not
+ */
+bool vm_unmap_range(uintptr_t root, uintptr_t address, uint64_t length) {
+  uintptr_t start = address & 0xFFFFFFFFFFFFF000;
+  uintptr_t end = (address + length + PAGE_SIZE - 1) & 0xFFFFFFFFFFFFF000;
+  bool all_mapped = true;
+
+  pt_entry_t* entry = NULL;
+  uintptr_t p = start;
+  while (p < end) {
+    int level = 1;
+    if (entry == NULL || p % PAGE_SIZE_2M == 0) {
+      entry = vm_walk(root, p, false, &level);
+    } else {
+      entry++;
+    }
+
+    // Skip over the whole region covered by a missing table or a large page
+    uint64_t size = PAGE_SIZE << (9 * (level - 1));
+    if (entry == NULL) {
+      all_mapped = false;
+    } else if (entry->present) {
+      entry->present = 0;
+      pmem_free_order((uintptr_t) (entry->address << 12), 9 * (level - 1));
+    } else {
+      all_mapped = false;
+    }
+    if (level > 1) entry = NULL;
+    p = (p | (size - 1)) + 1;
+  }
+
+  vm_flush_range(root, start, end);
+  return all_mapped;
+}
+
+/**
+ * Change the protections for a range of memory in a virtual address space. Large pages that overlap
+ * the range change completely. The TLB is flushed once for the whole range.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range
+ * \param length The length of the range in bytes
+ * \param user Should the pages be user-accessible or kernel only?
+ * \param writable Should the pages be writable?
+ * \param executable Should the pages be executable?
+ * \returns true if every page in the range was mapped, or false if some were not
+ */
+bool vm_protect_range(uintptr_t root, uintptr_t address, uint64_t length, bool user, bool writable, bool executable) {
+  uintptr_t start = address & 0xFFFFFFFFFFFFF000;
+  uintptr_t end = (address + length + PAGE_SIZE - 1) & 0xFFFFFFFFFFFFF000;
+  bool all_mapped = true;
+
+  pt_entry_t* entry = NULL;
+  uintptr_t p = start;
+  while (p < end) {
+    int level = 1;
+    if (entry == NULL || p % PAGE_SIZE_2M == 0) {
+      entry = vm_walk(root, p, false, &level);
+    } else {
+      entry++;
+    }
+
+    // Skip over the whole region covered by a missing table or a large page
+    uint64_t size = PAGE_SIZE << (9 * (level - 1));
+    if (entry != NULL && entry->present) {
+      entry->user = user;
+      entry->writable = writable;
+      entry->no_execute = executable;
+    } else {
+      all_mapped = false;
+    }
+    if (level > 1) entry = NULL;
+    p = (p | (size - 1)) + 1;
+  }
+
+  vm_flush_range(root, start, end);
+  return all_mapped;
+}
+
+#ifdef VM_BENCHMARK
+// Build with -DVM_BENCHMARK to time mapping, protecting and unmapping VM_BENCHMARK_SIZE bytes at boot,
+// a page at a time and then as one range. The region sits in the lower half, which is empty until the
+// first process starts.
+#define VM_BENCHMARK_BASE 0x400000000
+#define VM_BENCHMARK_SIZE (64 * 1024 * 1024)
+
+/**
+ * Maps, write-protects and unmaps VM_BENCHMARK_SIZE bytes of the current address space, first with
+ * vm_map, vm_protect and vm_unmap for each page, then with one vm_map_range, vm_protect_range and
+ * vm_unmap_range call, and prints the cycles each took per page.
+ */
+void vm_benchmark() {
+  uintptr_t root = read_cr3() & 0xFFFFFFFFFFFFF000;
+  uint64_t pages = VM_BENCHMARK_SIZE / PAGE_SIZE;
+
+  uint64_t start = rdtsc();
+  for (uint64_t i = 0; i < pages; i++) {
+    if (!vm_map(root, VM_BENCHMARK_BASE + i * PAGE_SIZE, false, true, false)) {
+      kprintf("vm benchmark: out of memory\n");
+      vm_unmap_range(root, VM_BENCHMARK_BASE, i * PAGE_SIZE);
+      return;
+    }
+  }
+  uint64_t map_page = rdtsc() - start;
+  start = rdtsc();
+  for (uint64_t i = 0; i < pages; i++) vm_protect(root, VM_BENCHMARK_BASE + i * PAGE_SIZE, false, false, false);
+  uint64_t protect_page = rdtsc() - start;
+  start = rdtsc();
+  for (uint64_t i = 0; i < pages; i++) vm_unmap(root, VM_BENCHMARK_BASE + i * PAGE_SIZE);
+  uint64_t unmap_page = rdtsc() - start;
+
+  start = rdtsc();
+  if (!vm_map_range(root, VM_BENCHMARK_BASE, VM_BENCHMARK_SIZE, false, true, false)) {
+    kprintf("vm benchmark: out of memory\n");
+    return;
+  }
+  uint64_t map_range = rdtsc() - start;
+  start = rdtsc();
+  vm_protect_range(root, VM_BENCHMARK_BASE, VM_BENCHMARK_SIZE, false, false, false);
+  uint64_t protect_range = rdtsc() - start;
+  start = rdtsc();
+  vm_unmap_range(root, VM_BENCHMARK_BASE, VM_BENCHMARK_SIZE);
+  uint64_t unmap_range = rdtsc() - start;
+
+  kprintf("vm %d MiB, cycles per page by page / as a range: map %lu / %lu, protect %lu / %lu, unmap %lu / %lu\n",
+          VM_BENCHMARK_SIZE / (1024 * 1024), map_page / pages, map_range / pages, protect_page / pages,
+          protect_range / pages, unmap_page / pages, unmap_range / pages);
+}
+#endif
+
+/**
+ * Copies the mappings below a page table for fork. Tables are duplicated; pages are shared, and writable
+ * pages become read-only copy-on-write pages in both the source and the copy.
+ * \param src The page table to copy
+ * \param dst The zeroed page table to copy into
+ * \param level The level of the tables (1 for tables of 4 KiB pages)
+ * \returns The number of pages shared, or -1 if memory ran out.
+ */
+static int64_t vm_fork_table(pt_entry_t* src, pt_entry_t* dst, int level) {
+  int64_t shared = 0;
+  for (size_t i = 0; i < 512; i++) {
+    if (!src[i].present) continue;
+    if (level == 1 || src[i].page_size) {
+      if (src[i].writable) {
+        src[i].writable = 0;
+        src[i].cow = 1;
+      }
+      dst[i] = src[i];
+      pmem_ref((uintptr_t) src[i].address << 12);
+      shared++;
+    } else {
+      // Allocate before copying, so vm_free_user never finds the source's table in the copy
+      uintptr_t table = pmem_alloc_zeroed();
+      if (table == 0) return -1;
+      dst[i] = src[i];
+      dst[i].address = table >> 12;
+      int64_t n = vm_fork_table((pt_entry_t*) phys_to_vir((void*) (uintptr_t) (src[i].address << 12)),
+                                (pt_entry_t*) phys_to_vir((void*) table), level - 1);
+      if (n < 0) return -1;
+      shared += n;
+    }
+  }
+  return shared;
+}
+
+/**
+ * Copies the lower half of an address space into another for fork. Pages are shared rather than copied;
+ * writable pages are write-protected in both address spaces and copied by vm_handle_cow on the first write.
+ * \param root The physical address of the top-level page table structure to copy
+ * \param new_root The physical address of the new address space's top-level table, with an empty lower half
+ * \returns The number of pages shared, or -1 if memory ran out. The new address space must be freed with
+ * vm_free_user on error.
+ */
+int64_t vm_fork_user(uintptr_t root, uintptr_t new_root) {
+  pt_entry_t* src = (pt_entry_t*) phys_to_vir((void*) (root & 0xFFFFFFFFFFFFF000));
+  pt_entry_t* dst = (pt_entry_t*) phys_to_vir((void*) (new_root & 0xFFFFFFFFFFFFF000));
+  int64_t shared = 0;
+  for (size_t l4_index = 0; l4_index < 256 && shared >= 0; l4_index++) {
+    if (!src[l4_index].present) continue;
+    uintptr_t table = pmem_alloc_zeroed();
+    if (table == 0) {
+      shared = -1;
+      break;
+    }
+    dst[l4_index] = src[l4_index];
+    dst[l4_index].address = table >> 12;
+    int64_t n = vm_fork_table((pt_entry_t*) phys_to_vir((void*) (uintptr_t) (src[l4_index].address << 12)),
+                              (pt_entry_t*) phys_to_vir((void*) table), 3);
+    shared = (n < 0 ? -1 : shared + n);
+  }
+
+  // Cached translations of the source may still allow writes
+  if ((root & 0xFFFFFFFFFFFFF000) == (read_cr3() & 0xFFFFFFFFFFFFF000)) write_cr3(read_cr3());
+  return shared;
+}
+
+/**
+ * Handles a write to a copy-on-write page. The page gets a private copy unless nothing else shares it,
+ * in which case it is simply made writable again.
+ * \param root The physical address of the top-level page table structure
+ * \param address The address that was written
+ * \returns true if the page was copy-on-write and can now be written, or false otherwise.
+ */
+bool vm_handle_cow(uintptr_t root, uintptr_t address) {
+  int level;
+  pt_entry_t* entry = vm_walk(root, address, false, &level);
+  if (entry == NULL || !entry->present || !entry->cow) return false;
+
+  uintptr_t page = (uintptr_t) entry->address << 12;
+  uint8_t order = (level - 1) * 9;
+  if (pmem_is_shared(page)) {
+    uintptr_t copy = pmem_alloc_order(order);
+    if (copy == 0) return false;
+    memcpy(phys_to_vir((void*) copy), phys_to_vir((void*) page), PAGE_SIZE << order);
+    entry->address = copy >> 12;
+    // Drop this address space's share of the original
+    pmem_free_order(page, order);
+  }
+  entry->writable = 1;
+  entry->cow = 0;
+  invalidate_tlb(address);
+  return true;
+}
+
+/**
+ * Checks that a range of addresses passed in by a process lies entirely in user space, so the kernel
+ * can't be made to read or write its own memory on the process's behalf.
+ * \param address The start of the range.
+ * \param length The length of the range in bytes.
+ * \returns true if the range is in the lower half and doesn't wrap around.
+ */
+bool vm_is_user_range(uintptr_t address, uint64_t length) {
+  return address <= USER_SPACE_END && length <= USER_SPACE_END - address;
+}
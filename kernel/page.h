@@ -4,6 +4,47 @@
 
 #define PAGE_SIZE 0x1000
 
+// Sizes of the large pages that can be mapped with vm_map_large
+#define PAGE_SIZE_2M 0x200000
+#define PAGE_SIZE_1G 0x40000000
+
+// The largest block order handed out by the physical memory allocator (2^18 pages = 1 GiB)
+#define PMEM_MAX_ORDER 18
+
+// Control register bits
+#define CR0_WP (1 << 16)
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CR3_NOFLUSH (1UL << 63)
+
+// Process-context identifiers are 12 bits wide
+#define MAX_PCID 4095
+
+// invpcid invalidation types
+#define INVPCID_SINGLE_CONTEXT 1
+#define INVPCID_ALL_NON_GLOBAL 3
+
+// Range operations touching more pages than this flush the whole TLB instead of single pages
+#define TLB_FLUSH_THRESHOLD 32
+
+// The most pre-zeroed pages kept ready for pmem_alloc_zeroed
+#define ZERO_POOL_SIZE 64
+
+// The largest number of usable memory ranges the physical memory allocator tracks
+#define PMEM_MAX_RANGES 32
+
+// The end of the lower half of the address space, which belongs to user processes
+#define USER_SPACE_END 0x800000000000
+
+/**
+ * Checks that a range of addresses passed in by a process lies entirely in user space, so the kernel
+ * can't be made to read or write its own memory on the process's behalf.
+ * \param address The start of the range.
+ * \param length The length of the range in bytes.
+ * \returns true if the range is in the lower half and doesn't wrap around.
+ */
+bool vm_is_user_range(uintptr_t address, uint64_t length);
+
 /**
  * Print a selected number of items on the freelist.
  *
@@ -18,6 +59,11 @@ uint64_t read_cr0();
 
 void write_cr0(uint64_t value);
 
+/** Reads the value of the cr2 register, which holds the address that caused the last page fault.
+* \returns The value of the cr2 register.
+*/
+uintptr_t read_cr2();
+
 /**
  * Obtain a pointer to the top-level page structure.
  * \returns a pointer to the top-level page structure.
@@ -29,6 +75,58 @@ uintptr_t read_cr3();
 */
 void write_cr3(uint64_t value);
 
+/** Reads the value of the cr4 register.
+* \returns The value of the cr4 register.
+*/
+uint64_t read_cr4();
+
+/** Writes a value to the cr4 register.
+* \param value The value to write
+*/
+void write_cr4(uint64_t value);
+
+/**
+ * Sets up the TLB features that avoid flushing kernel translations. The kernel's higher half mappings are
+ * marked global, then vm_init_cpu_tlb turns on global pages and PCIDs for the bootstrap processor.
+ * Must be called once the lower half of the kernel's address space has been unmapped.
+ * \param root The physical address of the kernel's top-level page table structure
+ */
+void vm_init_tlb(uintptr_t root);
+
+/**
+ * Turns on global pages (CR4.PGE) and PCIDs (CR4.PCIDE) for the running CPU, when they are supported.
+ * Every CPU must call this after vm_init_tlb has run on the bootstrap processor.
+ */
+void vm_init_cpu_tlb();
+
+/**
+ * Hands out a process-context identifier for a new address space. Each PCID is handed out once per
+ * round; when they run out, stale translations for every PCID are flushed before starting over.
+ * \returns A PCID that has no cached translations.
+ */
+uint16_t vm_pcid_alloc();
+
+/**
+ * Switches to an address space. With PCIDs, the translations cached for the new address space are kept.
+ * \param root The physical address of the top-level page table structure
+ * \param pcid The PCID of the address space, from vm_pcid_alloc
+ */
+void vm_switch(uintptr_t root, uint16_t pcid);
+
+/**
+ * Drops all non-global cached translations for an address space, such as after its mappings were torn down.
+ * \param pcid The PCID of the address space
+ */
+void vm_flush_pcid(uint16_t pcid);
+
+/**
+ * Frees every page mapped in the lower half of an address space, along with the tables that map them.
+ * Unlike unmap_lower_half, the mapped pages are assumed to belong to the address space. The address space
+ * must not be running.
+ * \param root The physical address of the top-level page table structure
+ */
+void vm_free_user(uintptr_t root);
+
 /**
  * This function unmaps everything in the lower half of an address space with level 4 page table at address root.
  *
@@ -46,26 +144,93 @@ uintptr_t peek_freelist();
 void translate(void* address);
 
 /**
- * Initializes the system's freelist. 
- * Takes an array of memory sections and adds all the pages in that section to the freelist.
+ * Initializes the system's physical memory allocator.
+ * Records the usable memory sections as ranges; pages are only handed to the buddy allocator's free lists
+ * when an allocation needs them, so no page is touched here. Space for the allocator's bitmap is taken
+ * from the first section large enough to hold it.
  *
- * \param start Pointer that is the start of the current memory section.
- * \param end Pointer that is the end of the current memory section.
+ * \param start Array of the start addresses of the memory sections.
+ * \param end Array of the end addresses of the memory sections.
  * \param num_sections The number of memory sections to process.
  */
 void freelist_init(uint64_t* start, uint64_t* end, uint16_t num_sections);
+
+/**
+ * Allocate a physically contiguous block of 2^order pages.
+ * \param order The order of the block to allocate, at most PMEM_MAX_ORDER.
+ * \returns the physical address of the allocated block, aligned to its size, or 0 on error.
+ */
+uintptr_t pmem_alloc_order(uint8_t order);
+
 /**
  * Allocate a page of physical memory.
  * \returns the physical address of the allocated physical memory or 0 on error.
  */
 uintptr_t pmem_alloc();
 
+/**
+ * Allocate a page of physical memory that is filled with zeroes.
+ * Pages come from the pre-zeroed pool when it has any, so zeroing stays off the caller's path.
+ * \returns the physical address of the allocated physical memory or 0 on error.
+ */
+uintptr_t pmem_alloc_zeroed();
+
+/**
+ * Zeroes one free page and adds it to the pre-zeroed pool. Meant to be called repeatedly when the CPU
+ * has nothing else to do, so it does a bounded amount of work per call.
+ * \returns true if a page was added, or false if the pool is full or memory is exhausted.
+ */
+bool pmem_zero_pool_refill();
+
+/**
+ * Reads the pre-zeroed pool's counters.
+ * \param hits Set to the number of pmem_alloc_zeroed calls served from the pool.
+ * \param misses Set to the number of pmem_alloc_zeroed calls that had to zero a page themselves.
+ */
+void pmem_zero_pool_stats(uint64_t* hits, uint64_t* misses);
+
+/**
+ * Records another owner for an allocated block, such as a page shared between address spaces after fork.
+ * Each extra owner must call pmem_free_order once before the block is actually freed.
+ * \param p The physical address of the block.
+ */
+void pmem_ref(uintptr_t p);
+
+/**
+ * Checks if an allocated block has more than one owner.
+ * \param p The physical address of the block.
+ * \returns true if the block is shared.
+ */
+bool pmem_is_shared(uintptr_t p);
+
+/**
+ * Free a block of 2^order pages, merging it with its buddy blocks when they are free. If the block is
+ * shared, this only drops one owner.
+ * \param p is the physical address of the block to free, which must be aligned to the block size.
+ * \param order The order the block was allocated with.
+ */
+void pmem_free_order(uintptr_t p, uint8_t order);
+
 /**
  * Free a page of physical memory.
  * \param p is the physical address of the page to free, which must be page-aligned.
  */
 void pmem_free(uintptr_t p);
 
+/**
+ * Print the number of free blocks of each order and the total number of free pages. For debugging.
+ */
+void pmem_print_stats();
+
+#ifdef PMEM_BENCHMARK
+/**
+ * Times order 0 allocations and frees, the only kind the old freelist could do, then a mix of orders.
+ * The mixed blocks are freed in two passes, every other one first, with the free block counts printed
+ * after each pass to show how fragmented memory is and how much merging recovers.
+ */
+void pmem_benchmark();
+#endif
+
 /**
  * Map a single page of memory into a virtual address space.
  * \param root The physical address of the top-level page table structure
@@ -78,7 +243,33 @@ void pmem_free(uintptr_t p);
 bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable);
 
 /**
- * Unmap a page from a virtual address space
+ * Map a single large page of memory into a virtual address space. The page is backed by a
+ * physically contiguous block and filled with zeroes.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map into the address space, must be aligned to page_size
+ * \param page_size The size of the page, either PAGE_SIZE_2M or PAGE_SIZE_1G
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param executable Should the page be executable?
+ * \returns true if the mapping succeeded, or false if there was an error
+ */
+bool vm_map_large(uintptr_t root, uintptr_t address, uint64_t page_size, bool user, bool writable, bool executable);
+
+/**
+ * Maps a page that is already allocated into a virtual address space, such as a page the kernel shares with
+ * every process. The page gets another owner, so freeing the address space only drops that owner.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map the page at, must be page-aligned
+ * \param page The physical address of the page
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param no_execute Should the page be non-executable?
+ * \returns true if the mapping succeeded, or false if the address is already mapped or memory ran out
+ */
+bool vm_map_shared(uintptr_t root, uintptr_t address, uintptr_t page, bool user, bool writable, bool no_execute);
+
+/**
+ * Unmap a page from a virtual address space. If the address is part of a large page, the whole large page is unmapped.
  * \param root The physical address of the top-level page table structure
  * \param address The virtual address to unmap from the address space
  * \returns true if successful, or false if anything goes wrong
@@ -86,7 +277,8 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
 bool vm_unmap(uintptr_t root, uintptr_t address);
 
 /**
- * Change the protections for a page in a virtual address space
+ * Change the protections for a page in a virtual address space. If the address is part of a large page,
+ * the protections of the whole large page change.
  * \param root The physical address of the top-level page table structure
  * \param address The virtual address to update
  * \param user Should the page be user-accessible or kernel only?
@@ -95,3 +287,67 @@ bool vm_unmap(uintptr_t root, uintptr_t address);
  * \returns true if successful, or false if anything goes wrong (e.g. page is not mapped)
  */
 bool vm_protect(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable);
+
+/**
+ * Map a range of memory into a virtual address space with 4 KiB pages. The page tables are walked
+ * once for every level 1 table the range touches, rather than once per page.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range, must be page-aligned
+ * \param length The length of the range in bytes. Rounded up to the next page.
+ * \param user Should the pages be user-accessible?
+ * \param writable Should the pages be writable?
+ * \param executable Should the pages be executable?
+ * \returns true if the mapping succeeded, or false if there was an error. Nothing is left mapped on error.
+ */
+bool vm_map_range(uintptr_t root, uintptr_t address, uint64_t length, bool user, bool writable, bool executable);
+
+/**
+ * Unmap a range of memory from a virtual address space, freeing the pages that backed it. Large pages
+ * that overlap the range are unmapped completely. The TLB is flushed once for the whole range.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range
+ * \param length The length of the range in bytes
+ * \returns true if every page in the range was mapped, or false if some were not
+ */
+bool vm_unmap_range(uintptr_t root, uintptr_t address, uint64_t length);
+
+/**
+ * Change the protections for a range of memory in a virtual address space. Large pages that overlap
+ * the range change completely. The TLB is flushed once for the whole range.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the start of the range
+ * \param length The length of the range in bytes
+ * \param user Should the pages be user-accessible or kernel only?
+ * \param writable Should the pages be writable?
+ * \param executable Should the pages be executable?
+ * \returns true if every page in the range was mapped, or false if some were not
+ */
+bool vm_protect_range(uintptr_t root, uintptr_t address, uint64_t length, bool user, bool writable, bool executable);
+
+#ifdef VM_BENCHMARK
+/**
+ * Maps, write-protects and unmaps VM_BENCHMARK_SIZE bytes of the current address space, first with
+ * vm_map, vm_protect and vm_unmap for each page, then with one vm_map_range, vm_protect_range and
+ * vm_unmap_range call, and prints the cycles each took per page.
+ */
+void vm_benchmark();
+#endif
+
+/**
+ * Copies the lower half of an address space into another for fork. Pages are shared rather than copied;
+ * writable pages are write-protected in both address spaces and copied by vm_handle_cow on the first write.
+ * \param root The physical address of the top-level page table structure to copy
+ * \param new_root The physical address of the new address space's top-level table, with an empty lower half
+ * \returns The number of pages shared, or -1 if memory ran out. The new address space must be freed with
+ * vm_free_user on error.
+ */
+int64_t vm_fork_user(uintptr_t root, uintptr_t new_root);
+
+/**
+ * Handles a write to a copy-on-write page. The page gets a private copy unless nothing else shares it,
+ * in which case it is simply made writable again.
+ * \param root The physical address of the top-level page table structure
+ * \param address The address that was written
+ * \returns true if the page was copy-on-write and can now be written, or false otherwise.
+ */
+bool vm_handle_cow(uintptr_t root, uintptr_t address);
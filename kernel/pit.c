@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#include "pit.h"
+#include "port.h"
+
+// PIT ports
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+
+// Channel 0, low byte then high byte, mode 3 (square wave), binary counting
+#define PIT_MODE_SQUARE_WAVE 0x36
+
+// The number of timer interrupts so far
+volatile uint64_t ticks = 0;
+
+/**
+ * Programs channel 0 of the programmable interval timer to raise IRQ0 periodically.
+ * \param hz The number of interrupts per second.
+ */
+void pit_init(uint32_t hz) {
+  uint32_t divisor = PIT_BASE_HZ / hz;
+  outb(PIT_COMMAND, PIT_MODE_SQUARE_WAVE);
+  outb(PIT_CHANNEL0, divisor & 0xFF);
+  outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+/**
+ * Counts a timer interrupt. Called from the IRQ0 handler.
+ */
+void pit_tick() {
+  ticks++;
+}
+
+/**
+ * Gets the number of timer interrupts since the timer was started.
+ * \returns The number of ticks.
+ */
+uint64_t pit_ticks() {
+  return ticks;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// The frequency of the PIT's input clock
+#define PIT_BASE_HZ 1193182
+
+// How often the timer interrupt fires
+#define TIMER_HZ 100
+
+/**
+ * Programs channel 0 of the programmable interval timer to raise IRQ0 periodically.
+ * \param hz The number of interrupts per second.
+ */
+void pit_init(uint32_t hz);
+
+/**
+ * Counts a timer interrupt. Called from the IRQ0 handler.
+ */
+void pit_tick();
+
+/**
+ * Gets the number of timer interrupts since the timer was started.
+ * \returns The number of ticks.
+ */
+uint64_t pit_ticks();
@@ -0,0 +1,531 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <strlib.h>
+
+#include "process.h"
+#include "context_switch.h"
+#include "usermode_entry.h"
+#include "kmem.h"
+#include "kprint.h"
+#include "loader.h"
+#include "page.h"
+#include "gdt.h"
+#include "boot.h"
+#include "cpu.h"
+#include "smp.h"
+#include "pit.h"
+#include "run_queue.h"
+#include "ring.h"
+#include "wait_queue.h"
+
+// Assembly stub that returns to user mode from a copied syscall frame with a result of 0
+extern void fork_return();
+
+// Objects for process structs
+kmem_cache_t* process_cache = NULL;
+
+// The kernel's boot thread. It runs in the kernel's address space and waits on the shell.
+process_t kernel_process;
+
+// The next process ID to hand out
+uint64_t next_pid = 1;
+
+// The number of processes allocated, which is capped so no run queue can fill up
+uint64_t process_count = 0;
+
+// Each CPU's queue of processes that are ready to run
+run_queue_t run_queues[MAX_CPUS];
+
+// Each CPU's idle process, which runs when nothing else is ready, and the timer ticks each CPU has taken
+process_t idle_processes[MAX_CPUS];
+uint64_t cpu_ticks[MAX_CPUS];
+
+// The bootstrap processor's idle process needs a stack of its own, since its boot thread is kernel_process
+static uint8_t idle_stack[PAGE_SIZE << KERNEL_STACK_ORDER] __attribute__((aligned(16)));
+
+// Processes that exited with nothing waiting for them. They are freed once they are off the CPU.
+process_t* zombies = NULL;
+
+#ifdef SCHED_BENCHMARK
+// Build with -DSCHED_BENCHMARK to print the average cost of a context switch every SCHED_BENCHMARK_SWITCHES switches
+#define SCHED_BENCHMARK_SWITCHES 1000
+uint64_t switch_start = 0;
+uint64_t switch_cycles = 0;
+uint64_t switch_count = 0;
+
+// Forked processes that have not exited, the number that have, and the tick the first of them was forked at.
+// A summary is printed every time they have all exited.
+uint64_t tasks_running = 0;
+uint64_t tasks_done = 0;
+uint64_t tasks_start = 0;
+#endif
+
+static void process_prepare_stack(process_t* proc, uintptr_t* sp, void (*start)());
+static void process_idle();
+
+/**
+ * Sets up a CPU's idle process. It runs in the kernel's address space.
+ * \param cpu The index of the CPU.
+ * \returns The idle process.
+ */
+static process_t* process_init_idle(uint32_t cpu) {
+  process_t* idle = &idle_processes[cpu];
+  memset(idle, 0, sizeof(process_t));
+  idle->state = PROCESS_RUNNING;
+  idle->root = kernel_process.root;
+  idle->pcid = kernel_process.pcid;
+  idle->last_cpu = cpu;
+  return idle;
+}
+
+/**
+ * Sets up the process that represents the kernel's own boot thread, using the address space that is
+ * running. Must be called after the kernel object allocator is initialized and the lower half is unmapped.
+ */
+void process_init() {
+  process_cache = kmem_cache_create("process", sizeof(process_t), 0);
+
+  memset(&kernel_process, 0, sizeof(process_t));
+  kernel_process.pid = 0;
+  kernel_process.state = PROCESS_RUNNING;
+  kernel_process.root = read_cr3() & 0xFFFFFFFFFFFFF000;
+  kernel_process.pcid = read_cr3() & 0xFFF;
+  kernel_process.mmap_next_start = MMAP_BASE;
+  this_cpu()->running = &kernel_process;
+
+  // As in process_spawn, the zero stands in for a return address to keep the stack aligned
+  process_t* idle = process_init_idle(0);
+  uintptr_t* sp = (uintptr_t*) (idle_stack + sizeof(idle_stack));
+  *--sp = 0;
+  process_prepare_stack(idle, sp, process_idle);
+}
+
+/**
+ * Gets the running process.
+ * \returns A pointer to the running process.
+ */
+process_t* current_process() {
+  return this_cpu()->running;
+}
+
+/**
+ * Gets the address just past the top of a process's kernel stack.
+ * \param proc The process.
+ * \returns The top of the kernel stack, in the higher half.
+ */
+static uintptr_t process_stack_top(process_t* proc) {
+  return (uintptr_t) phys_to_vir((void*) proc->kernel_stack) + (PAGE_SIZE << KERNEL_STACK_ORDER);
+}
+
+/**
+ * The first code a new process runs on its kernel stack. Enters the program in user mode.
+ */
+static void process_start() {
+  process_t* proc = current_process();
+  // Processes are switched to with the kernel lock held
+  kernel_unlock();
+  usermode_entry(USER_DATA_SELECTOR | 0x3,  // User data selector with priv=3
+                 proc->user_sp,             // The top of the user stack
+                 USER_CODE_SELECTOR | 0x3,  // User code selector with priv=3
+                 proc->entry);              // Jump to the entry point specified in the ELF file
+}
+
+/**
+ * Switches from the running process to another one. Returns when something switches back to from.
+ * \param from The running process.
+ * \param to The process to run.
+ */
+static void process_switch(process_t* from, process_t* to) {
+#ifdef SCHED_BENCHMARK
+  switch_start = rdtsc();
+#endif
+  cpu_t* cpu = this_cpu();
+  cpu->running = to;
+  if (to->kernel_stack != 0) gdt_set_kernel_stack(process_stack_top(to));
+  vm_switch(to->root, to->pcid);
+  // A process that last ran elsewhere may have changed mappings this CPU still has cached
+  if (to->last_cpu != cpu->id) {
+    vm_flush_pcid(to->pcid);
+    to->last_cpu = cpu->id;
+  }
+  context_switch(&from->saved_sp, to->saved_sp);
+#ifdef SCHED_BENCHMARK
+  // Only switches back into a process that was switched away from are timed
+  switch_cycles += rdtsc() - switch_start;
+  if (++switch_count == SCHED_BENCHMARK_SWITCHES) {
+    kprintf("context switch: %lu cycles on average\n", switch_cycles / switch_count);
+    switch_cycles = 0;
+    switch_count = 0;
+  }
+#endif
+}
+
+/**
+ * Adds a process to the back of the running CPU's run queue.
+ * \param proc The process.
+ */
+static void process_ready(process_t* proc) {
+  // Can't fail, since the queue has room for every process
+  run_queue_push(&run_queues[this_cpu()->id], proc);
+}
+
+/**
+ * Finds the CPU with the most processes waiting in its run queue.
+ * \param self The running CPU, which is skipped.
+ * \param length Set to the length of the busiest run queue.
+ * \returns The index of the busiest CPU, or self if every other queue is empty.
+ */
+static uint32_t process_busiest_cpu(uint32_t self, int64_t* length) {
+  uint32_t busiest = self;
+  *length = 0;
+  for (uint32_t i = 0; i < cpu_count(); i++) {
+    int64_t n = run_queue_length(&run_queues[i]);
+    if (i != self && n > *length) {
+      busiest = i;
+      *length = n;
+    }
+  }
+  return busiest;
+}
+
+/**
+ * Takes the next ready process for the running CPU. Processes come from the CPU's own run queue first,
+ * and are stolen from the busiest other CPU when that is empty. Does not need the kernel lock.
+ * \returns The process, or NULL if nothing is ready.
+ */
+static process_t* process_next() {
+  uint32_t self = this_cpu()->id;
+  process_t* proc = run_queue_take(&run_queues[self]);
+  if (proc != NULL) return proc;
+
+  int64_t length;
+  uint32_t busiest = process_busiest_cpu(self, &length);
+  if (busiest == self) return NULL;
+  return run_queue_take(&run_queues[busiest]);
+}
+
+/**
+ * Moves a process from the busiest CPU's run queue to the running CPU's, if that evens them out. Stealing only
+ * happens once a CPU runs out of work; this keeps queues from staying lopsided while every CPU is busy.
+ */
+static void process_balance() {
+  uint32_t self = this_cpu()->id;
+  int64_t busiest_length;
+  uint32_t busiest = process_busiest_cpu(self, &busiest_length);
+  // Moving a process only helps if the busiest queue has at least two more waiting
+  if (busiest == self || busiest_length - run_queue_length(&run_queues[self]) < 2) return;
+
+  process_t* proc = run_queue_take(&run_queues[busiest]);
+  if (proc != NULL) process_ready(proc);
+}
+
+/**
+ * Frees a process that is not running, including its address space and kernel stack.
+ * \param proc The process to free.
+ */
+static void process_destroy(process_t* proc) {
+  vm_free_user(proc->root);
+  pmem_free(proc->root);
+  vma_clear(&proc->vmas);
+  if (proc->kernel_stack != 0) pmem_free_order(proc->kernel_stack, KERNEL_STACK_ORDER);
+  // Stale translations tagged with the PCID are dropped before it is handed out again
+  kmem_cache_free(process_cache, proc);
+  process_count--;
+}
+
+/**
+ * Allocates a process with an empty lower half, a kernel stack and a PCID.
+ * \returns The new process, or NULL if memory ran out or there are already MAX_PROCESSES processes.
+ */
+static process_t* process_alloc() {
+  if (process_count == MAX_PROCESSES) return NULL;
+  process_t* proc = kmem_cache_alloc(process_cache);
+  if (proc == NULL) return NULL;
+  process_count++;
+  memset(proc, 0, sizeof(process_t));
+  proc->state = PROCESS_RUNNING;
+  proc->mmap_next_start = MMAP_BASE;
+  // The loader caches translations for the new address space on this CPU
+  proc->last_cpu = this_cpu()->id;
+
+  // The new address space shares the kernel's higher half, so only the top-level table is copied
+  proc->root = pmem_alloc_zeroed();
+  if (proc->root == 0) {
+    kmem_cache_free(process_cache, proc);
+    process_count--;
+    return NULL;
+  }
+  uint64_t* kernel_l4 = phys_to_vir((void*) kernel_process.root);
+  uint64_t* l4 = phys_to_vir((void*) proc->root);
+  memcpy(&l4[256], &kernel_l4[256], 256 * sizeof(uint64_t));
+
+  proc->kernel_stack = pmem_alloc_order(KERNEL_STACK_ORDER);
+  if (proc->kernel_stack == 0) {
+    process_destroy(proc);
+    return NULL;
+  }
+  proc->pcid = vm_pcid_alloc();
+  return proc;
+}
+
+/**
+ * Sets up a kernel stack so the first switch to a process returns into a function.
+ * \param proc The process.
+ * \param sp Where the stack starts.
+ * \param start The function to start in.
+ */
+static void process_prepare_stack(process_t* proc, uintptr_t* sp, void (*start)()) {
+  *--sp = (uintptr_t) start;
+  for (int i = 0; i < CONTEXT_SWITCH_SAVED_REGS; i++) *--sp = 0;
+  *--sp = CONTEXT_SWITCH_INITIAL_FLAGS;
+  proc->saved_sp = (uintptr_t) sp;
+}
+
+/**
+ * Creates a process with its own address space and loads a program into it. The process does not run
+ * until process_wait is called.
+ * \param name The name of the module to load.
+ * \param result Set to the new process on success.
+ * \returns 0 on success, or the error code from load_exec_elf, or -3 if memory ran out or there are
+ * too many processes.
+ */
+int32_t process_spawn(char* name, process_t** result) {
+  process_t* proc = process_alloc();
+  if (proc == NULL) return -3;
+
+  int32_t rc = load_exec_elf(name, get_modules_tag(), proc);
+  if (rc < 0) {
+    process_destroy(proc);
+    return rc;
+  }
+
+  // The zero above the return address stands in for process_start's own return address, which keeps
+  // the stack aligned the way the compiler expects at function entry
+  uintptr_t* sp = (uintptr_t*) process_stack_top(proc);
+  *--sp = 0;
+  process_prepare_stack(proc, sp, process_start);
+
+  proc->pid = next_pid++;
+  *result = proc;
+  return 0;
+}
+
+/**
+ * Creates a copy of the running process. Memory is shared copy-on-write, so only page tables are copied.
+ * The child resumes from the same system call with a result of 0. Nothing waits for the child; it
+ * is freed once it exits.
+ * \returns The child's process ID, or -1 if memory ran out or there are too many processes.
+ */
+int64_t process_fork() {
+  process_t* parent = current_process();
+#ifdef FORK_BENCHMARK
+  uint64_t start = rdtsc();
+#endif
+  process_t* child = process_alloc();
+  if (child == NULL) return -1;
+
+  int64_t shared = vm_fork_user(parent->root, child->root);
+  if (shared < 0 || !vma_copy(&child->vmas, parent->vmas)) {
+    process_destroy(child);
+    return -1;
+  }
+  child->mmap_next_start = parent->mmap_next_start;
+
+  // The child's copy of the rings sits at the same address, with the same entries queued
+  child->ring = parent->ring;
+  child->ring_sq_head = parent->ring_sq_head;
+  child->ring_cq_tail = parent->ring_cq_tail;
+  child->ring_poll = parent->ring_poll;
+
+  // The child returns to user mode through a copy of the parent's syscall frame
+  syscall_frame_t* frame = (syscall_frame_t*) (process_stack_top(child) - sizeof(syscall_frame_t));
+  memcpy(frame, (void*) (process_stack_top(parent) - sizeof(syscall_frame_t)), sizeof(syscall_frame_t));
+  process_prepare_stack(child, (uintptr_t*) frame, fork_return);
+  child->pid = next_pid++;
+#ifdef FORK_BENCHMARK
+  kprintf("fork: %lu cycles to share %ld pages\n", rdtsc() - start, shared);
+#endif
+#ifdef SCHED_BENCHMARK
+  if (tasks_running++ == 0) tasks_start = pit_ticks();
+#endif
+
+  process_ready(child);
+  return child->pid;
+}
+
+/**
+ * Frees every exited process that nothing is waiting for, except the running one.
+ */
+static void process_reap() {
+  process_t** link = &zombies;
+  while (*link != NULL) {
+    process_t* proc = *link;
+    if (proc == current_process()) {
+      link = &proc->next;
+    } else {
+      *link = proc->next;
+      process_destroy(proc);
+    }
+  }
+}
+
+/**
+ * Picks the next process to run and switches to it. A running process goes to the back of the CPU's run
+ * queue; a waiting, blocked or exited one stays off it. Processes on wait queues that interrupt handlers
+ * signaled are woken first. If nothing is ready and the running process can't continue, the CPU switches
+ * to its idle process until something is. Must be called with the kernel lock held.
+ * \returns true if another process ran, or false if the running process just keeps going.
+ */
+static bool process_schedule() {
+  process_reap();
+  wait_queue_run_signals();
+
+  process_t* from = current_process();
+  process_t* to = process_next();
+  if (to == NULL) {
+    if (from->state == PROCESS_RUNNING) {
+      from->slice = SCHED_SLICE_TICKS;
+      return false;
+    }
+    to = &idle_processes[this_cpu()->id];
+  } else if (from->state == PROCESS_RUNNING) {
+    process_ready(from);
+  }
+
+  to->slice = SCHED_SLICE_TICKS;
+  process_switch(from, to);
+  return true;
+}
+
+/**
+ * The loop a CPU's idle process runs. Waits for a ready process without holding the kernel lock, then
+ * takes the lock and switches to it. Processes switch back here, with the lock held, when their CPU has
+ * nothing else to run.
+ */
+static void process_idle() {
+  process_t* self = current_process();
+  while (true) {
+    kernel_unlock();
+    process_t* next = process_next();
+    while (next == NULL) {
+      // If no other CPU is in the kernel, wake processes whose wait queues were signaled while halted,
+      // or else spend the time zeroing pages. Halt with interrupts on once there is nothing left to do.
+      bool refilled = false;
+      if (kernel_trylock()) {
+        wait_queue_run_signals();
+        next = process_next();
+        if (next == NULL) refilled = pmem_zero_pool_refill();
+        kernel_unlock();
+      }
+      if (next != NULL) break;
+      if (!refilled) __asm__ volatile("sti; hlt");
+      next = process_next();
+    }
+
+    kernel_lock();
+    next->slice = SCHED_SLICE_TICKS;
+    process_switch(self, next);
+  }
+}
+
+/**
+ * Turns the running CPU's boot thread into its idle process, which runs ready processes from then on.
+ * Called by each application processor once it is set up. Does not return.
+ */
+void process_run_idle() {
+  kernel_lock();
+  this_cpu()->running = process_init_idle(this_cpu()->id);
+  process_idle();
+}
+
+/**
+ * Lets another process run if one is ready. The running process goes to the back of the CPU's run queue.
+ * \returns true if another process ran, or false if nothing else was ready.
+ */
+bool process_yield() {
+  if (current_process() == NULL) return false;
+  return process_schedule();
+}
+
+/**
+ * Charges a timer tick to the running process, and preempts it once its time slice is used up. Every
+ * SCHED_BALANCE_TICKS ticks, the CPU also evens out its run queue against the busiest one. A process
+ * that set up its rings with RING_POLL has them drained first.
+ * Processes are only preempted in user mode, since the kernel is not reentrant.
+ * \param from_user Did the tick interrupt user mode?
+ */
+void process_tick(bool from_user) {
+  process_t* proc = current_process();
+  if (proc == NULL || !from_user) return;
+
+  kernel_lock();
+  if (proc->ring_poll) ring_drain(proc, false);
+  if (++cpu_ticks[this_cpu()->id] % SCHED_BALANCE_TICKS == 0) process_balance();
+  if (proc->slice > 0) proc->slice--;
+  if (proc->slice == 0) process_schedule();
+  kernel_unlock();
+}
+
+/**
+ * Switches away from the running process, which must be marked PROCESS_BLOCKED, until process_wake makes
+ * it ready again. Must be called with the kernel lock held.
+ */
+void process_block() {
+  process_schedule();
+}
+
+/**
+ * Makes a blocked process ready to run, on the running CPU's run queue. Must be called with the kernel
+ * lock held.
+ * \param proc The process.
+ */
+void process_wake(process_t* proc) {
+  proc->state = PROCESS_RUNNING;
+  // The process may be the one about to block, which hasn't switched away yet and so just keeps running
+  if (proc != current_process()) process_ready(proc);
+}
+
+/**
+ * Runs a child process until it exits, then frees it.
+ * \param child A process returned by process_spawn.
+ * \returns The code the child exited with.
+ */
+uint64_t process_wait(process_t* child) {
+  process_t* parent = current_process();
+  child->parent = parent;
+  parent->state = PROCESS_WAITING;
+  process_ready(child);
+  process_schedule();
+
+  // The child made us runnable again from process_exit, and is off the CPU by now
+  uint64_t code = child->exit_code;
+  process_destroy(child);
+  return code;
+}
+
+/**
+ * Ends the running process, waking the process waiting for it. Does not return.
+ * \param code The exit code to hand to the waiting process.
+ */
+void process_exit(uint64_t code) {
+  process_t* proc = current_process();
+  proc->exit_code = code;
+  proc->state = PROCESS_EXITED;
+  if (proc->parent != NULL) {
+    proc->parent->state = PROCESS_RUNNING;
+    process_ready(proc->parent);
+  } else {
+    // Nothing will free this process, so the scheduler does once it is off the CPU
+    proc->next = zombies;
+    zombies = proc;
+#ifdef SCHED_BENCHMARK
+    tasks_done++;
+    if (--tasks_running == 0) {
+      kprintf("%lu forked processes finished in %lu ms on %u CPUs\n", tasks_done,
+              (pit_ticks() - tasks_start) * 1000 / TIMER_HZ, cpu_count());
+      tasks_done = 0;
+    }
+#endif
+  }
+  process_schedule();
+}
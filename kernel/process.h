@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vma.h"
+#include "run_queue.h"
+
+// Each process gets a kernel stack of this order for system calls and interrupts
+#define KERNEL_STACK_ORDER 2
+
+// The number of timer ticks a process runs in user mode before another process gets the CPU
+#define SCHED_SLICE_TICKS 2
+
+// How often, in timer ticks, each CPU evens out its run queue against the busiest one
+#define SCHED_BALANCE_TICKS 10
+
+// The most processes that can exist at once. Any one run queue can hold all of them and the kernel's own process.
+#define MAX_PROCESSES (RUN_QUEUE_SIZE - 1)
+
+// Where mmap places mappings when no location is requested
+#define MMAP_BASE 0x9000000000
+
+// The registers syscall_entry leaves at the top of a process's kernel stack, lowest address first
+typedef struct syscall_frame {
+  uint64_t r15;
+  uint64_t r14;
+  uint64_t r13;
+  uint64_t r12;
+  uint64_t rbx;
+  uint64_t rbp;
+  // Pushed by the CPU on entry
+  uintptr_t ip;
+  uint64_t cs;
+  uint64_t flags;
+  uintptr_t sp;
+  uint64_t ss;
+} syscall_frame_t;
+
+typedef enum process_state {
+  // Running or waiting on the run queue
+  PROCESS_RUNNING,
+  // Waiting for a child to exit
+  PROCESS_WAITING,
+  // Waiting on a wait queue
+  PROCESS_BLOCKED,
+  PROCESS_EXITED
+} process_state_t;
+
+typedef struct process {
+  uint64_t pid;
+  process_state_t state;
+  // The physical address of the top-level page table, and the PCID the address space's translations are tagged with
+  uintptr_t root;
+  uint16_t pcid;
+  // Reserved ranges of user memory, and where the next mmap without a requested location goes
+  vma_t* vmas;
+  uintptr_t mmap_next_start;
+  // The physical address of the kernel stack, and the saved stack pointer while the process is switched out
+  uintptr_t kernel_stack;
+  uintptr_t saved_sp;
+  // Where the process starts running in user mode
+  uintptr_t entry;
+  uintptr_t user_sp;
+  // The process waiting for this one to exit, or NULL if nothing will wait for it
+  struct process* parent;
+  uint64_t exit_code;
+  // Timer ticks left before the process is preempted
+  uint32_t slice;
+  // The CPU the process last ran on. Only that CPU's TLB can hold up-to-date translations for its PCID.
+  uint32_t last_cpu;
+  // The process's submission and completion rings, or NULL if it hasn't set them up. The kernel keeps
+  // its own ends of the rings here, since the process can write to the copies in the ring.
+  struct ring* ring;
+  uint32_t ring_sq_head;
+  uint32_t ring_cq_tail;
+  // Are the rings drained on timer ticks as well as by ring_enter?
+  bool ring_poll;
+  // The next process on the list of exited processes
+  struct process* next;
+  // The next process blocked on the same wait queue
+  struct process* wait_next;
+} process_t;
+
+/**
+ * Sets up the process that represents the kernel's own boot thread, using the address space that is
+ * running. Must be called after the kernel object allocator is initialized and the lower half is unmapped.
+ */
+void process_init();
+
+/**
+ * Turns the running CPU's boot thread into its idle process, which runs ready processes from then on.
+ * Called by each application processor once it is set up. Does not return.
+ */
+void process_run_idle();
+
+/**
+ * Gets the running process.
+ * \returns A pointer to the running process.
+ */
+process_t* current_process();
+
+/**
+ * Creates a process with its own address space and loads a program into it. The process does not run
+ * until process_wait is called.
+ * \param name The name of the module to load.
+ * \param result Set to the new process on success.
+ * \returns 0 on success, or the error code from load_exec_elf, or -3 if memory ran out or there are
+ * too many processes.
+ */
+int32_t process_spawn(char* name, process_t** result);
+
+/**
+ * Creates a copy of the running process. Memory is shared copy-on-write, so only page tables are copied.
+ * The child resumes from the same system call with a result of 0. Nothing waits for the child; it
+ * is freed once it exits.
+ * \returns The child's process ID, or -1 if memory ran out or there are too many processes.
+ */
+int64_t process_fork();
+
+/**
+ * Lets another process run if one is ready. The running process goes to the back of the CPU's run queue.
+ * \returns true if another process ran, or false if nothing else was ready.
+ */
+bool process_yield();
+
+/**
+ * Charges a timer tick to the running process, and preempts it once its time slice is used up. Every
+ * SCHED_BALANCE_TICKS ticks, the CPU also evens out its run queue against the busiest one. A process
+ * that set up its rings with RING_POLL has them drained first.
+ * Processes are only preempted in user mode, since the kernel is not reentrant.
+ * \param from_user Did the tick interrupt user mode?
+ */
+void process_tick(bool from_user);
+
+/**
+ * Switches away from the running process, which must be marked PROCESS_BLOCKED, until process_wake makes
+ * it ready again. Must be called with the kernel lock held.
+ */
+void process_block();
+
+/**
+ * Makes a blocked process ready to run, on the running CPU's run queue. Must be called with the kernel
+ * lock held.
+ * \param proc The process.
+ */
+void process_wake(process_t* proc);
+
+/**
+ * Runs a child process until it exits, then frees it.
+ * \param child A process returned by process_spawn.
+ * \returns The code the child exited with.
+ */
+uint64_t process_wait(process_t* child);
+
+/**
+ * Ends the running process, waking the process waiting for it. Does not return.
+ * \param code The exit code to hand to the waiting process.
+ */
+void process_exit(uint64_t code);
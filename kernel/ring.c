@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <io_ring.h>
+
+#include "ring.h"
+#include "syscall_def.h"
+
+/**
+ * Runs the operations a process has queued on its submission ring, in order, posting each result to
+ * the completion ring. Stops early if the completion ring is full. The kernel lock must be held and the
+ * process's address space must be running.
+ * \param proc The process, which must have set up its rings.
+ * \param blocking May operations that wait, such as reads, run? If not, draining stops at the first one.
+ * \returns The number of operations run.
+ */
+uint32_t ring_drain(process_t* proc, bool blocking) {
+  ring_t* ring = proc->ring;
+  uint32_t done = 0;
+
+  // A process that claims to have queued more than the ring holds only gets one ring's worth run
+  uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+  if (tail - proc->ring_sq_head > RING_ENTRIES) tail = proc->ring_sq_head + RING_ENTRIES;
+
+  while (proc->ring_sq_head != tail) {
+    // Leave the operation queued until there is somewhere to put its result
+    uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+    if (proc->ring_cq_tail - cq_head >= RING_ENTRIES) break;
+
+    // Copy the entry first, so the process can't change it while it runs
+    ring_sqe_t sqe = ring->sq[proc->ring_sq_head % RING_ENTRIES];
+    if (sqe.op == SYS_read && !blocking) break;
+
+    int64_t result = -1;
+    if (sqe.op == SYS_read || sqe.op == SYS_write || sqe.op == SYS_mmap) {
+      result = syscall_run(sqe.op, sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3], sqe.args[4], sqe.args[5]);
+    }
+
+    ring_cqe_t* cqe = &ring->cq[proc->ring_cq_tail % RING_ENTRIES];
+    cqe->user_data = sqe.user_data;
+    cqe->result = result;
+    proc->ring_cq_tail++;
+    proc->ring_sq_head++;
+    __atomic_store_n(&ring->cq_tail, proc->ring_cq_tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->sq_head, proc->ring_sq_head, __ATOMIC_RELEASE);
+    done++;
+  }
+  return done;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "process.h"
+
+/**
+ * Runs the operations a process has queued on its submission ring, in order, posting each result to
+ * the completion ring. Stops early if the completion ring is full. The kernel lock must be held and the
+ * process's address space must be running.
+ * \param proc The process, which must have set up its rings.
+ * \param blocking May operations that wait, such as reads, run? If not, draining stops at the first one.
+ * \returns The number of operations run.
+ */
+uint32_t ring_drain(process_t* proc, bool blocking);
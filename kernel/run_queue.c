@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "run_queue.h"
+
+/**
+ * Adds a process to the bottom of a run queue. Only the CPU that owns the queue may push to it.
+ * \param queue The queue.
+ * \param proc The process.
+ * \returns true on success, or false if the queue is full.
+ */
+bool run_queue_push(run_queue_t* queue, struct process* proc) {
+  int64_t bottom = queue->bottom;
+  int64_t top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+  // A slot is only reused once top has moved past it, so no other CPU can still be reading it
+  if (bottom - top >= RUN_QUEUE_SIZE) return false;
+
+  queue->slots[bottom & (RUN_QUEUE_SIZE - 1)] = proc;
+  // The process must be in its slot before other CPUs can see the new bottom
+  __atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Takes the process at the top of a run queue. Any CPU may take from any queue.
+ * \param queue The queue.
+ * \returns The process, or NULL if the queue was empty.
+ */
+struct process* run_queue_take(run_queue_t* queue) {
+  while (true) {
+    int64_t top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return NULL;
+
+    // Read the slot before claiming it. If another CPU claimed it first, try the next one.
+    struct process* proc = queue->slots[top & (RUN_QUEUE_SIZE - 1)];
+    if (__atomic_compare_exchange_n(&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      return proc;
+    }
+    __asm__ volatile("pause");
+  }
+}
+
+/**
+ * Counts the processes in a run queue. The count may be stale by the time it is used.
+ * \param queue The queue.
+ * \returns The number of processes in the queue.
+ */
+int64_t run_queue_length(run_queue_t* queue) {
+  int64_t length = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+  return length > 0 ? length : 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The number of processes one run queue can hold. Must be a power of two.
+#define RUN_QUEUE_SIZE 1024
+
+struct process;
+
+// A CPU's queue of runnable processes. This is a Chase-Lev work-stealing deque with a fixed-size buffer:
+// only the owning CPU pushes, at the bottom, and every CPU takes from the top with a compare-and-swap.
+// The owner takes from the top too, so its processes run in the order they were queued.
+typedef struct run_queue {
+  // The index of the next process to take. Only ever increases.
+  volatile int64_t top;
+  // The index where the owner pushes the next process
+  volatile int64_t bottom;
+  struct process* volatile slots[RUN_QUEUE_SIZE];
+} run_queue_t;
+
+/**
+ * Adds a process to the bottom of a run queue. Only the CPU that owns the queue may push to it.
+ * \param queue The queue.
+ * \param proc The process.
+ * \returns true on success, or false if the queue is full.
+ */
+bool run_queue_push(run_queue_t* queue, struct process* proc);
+
+/**
+ * Takes the process at the top of a run queue. Any CPU may take from any queue.
+ * \param queue The queue.
+ * \returns The process, or NULL if the queue was empty.
+ */
+struct process* run_queue_take(run_queue_t* queue);
+
+/**
+ * Counts the processes in a run queue. The count may be stale by the time it is used.
+ * \param queue The queue.
+ * \returns The number of processes in the queue.
+ */
+int64_t run_queue_length(run_queue_t* queue);
@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "serial.h"
+#include "port.h"
+#include "pic.h"
+#include "key.h"
+#include "spinlock.h"
+
+// UART registers, as offsets from the port's base. With LCR_DLAB set, the first two hold the baud rate divisor.
+#define UART_DATA 0
+#define UART_IER 1
+#define UART_IIR 2
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+// Interrupt enable bits: data received, and transmit holding register empty
+#define IER_RX 0x01
+#define IER_TX 0x02
+
+// Line control: 8 data bits, no parity, one stop bit, and the bit that exposes the divisor
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+
+// Enable and clear the FIFOs, interrupting once 14 characters are received
+#define FCR_ENABLE 0xC7
+
+// Modem control: DTR, RTS and OUT2, which connects the UART's interrupt line. Loopback mode for the self-test.
+#define MCR_NORMAL 0x0B
+#define MCR_LOOPBACK 0x1E
+
+// Line status: a received character is waiting, and the transmit FIFO is empty
+#define LSR_DATA_READY 0x01
+#define LSR_THR_EMPTY 0x20
+
+// The number of characters the transmit FIFO holds, and the divisor for 115200 baud
+#define UART_FIFO_SIZE 16
+#define SERIAL_DIVISOR 1
+
+// The most characters serial_write queues with interrupts off
+#define SERIAL_CHUNK 256
+
+// Characters waiting to be sent, starting at tx_head. Interrupt handlers print too, so the lock is
+// always taken with interrupts off.
+static char tx_buffer[SERIAL_BUFFER_SIZE];
+static size_t tx_head = 0;
+static size_t tx_count = 0;
+static spinlock_t tx_lock;
+
+// The interrupts enabled on the UART
+static uint8_t serial_ier = 0;
+
+// Did serial_init find a UART?
+static bool serial_present = false;
+
+// Set by serial_panic. Writes then go straight to the port, without the lock or the buffer.
+static volatile bool serial_panicked = false;
+
+/**
+ * Sets up the COM1 UART at 115200 baud, 8N1, with its FIFOs and interrupts on. Received characters are
+ * passed to the keyboard buffer, so reads take input from the serial port and the keyboard alike.
+ * Must be called after the PICs are initialized.
+ * \returns true on success, or false if there is no working UART.
+ */
+bool serial_init() {
+  outb(COM1 + UART_IER, 0);
+  outb(COM1 + UART_LCR, LCR_DLAB);
+  outb(COM1 + UART_DATA, SERIAL_DIVISOR & 0xFF);
+  outb(COM1 + UART_IER, (SERIAL_DIVISOR >> 8) & 0xFF);
+  outb(COM1 + UART_LCR, LCR_8N1);
+  outb(COM1 + UART_FCR, FCR_ENABLE);
+
+  // Make sure a UART is there by sending a character to ourselves
+  outb(COM1 + UART_MCR, MCR_LOOPBACK);
+  outb(COM1 + UART_DATA, 0xAE);
+  if (inb(COM1 + UART_DATA) != 0xAE) return false;
+  outb(COM1 + UART_MCR, MCR_NORMAL);
+
+  serial_ier = IER_RX;
+  outb(COM1 + UART_IER, serial_ier);
+  serial_present = true;
+  pic_unmask_irq(COM1_IRQ);
+  return true;
+}
+
+/**
+ * Moves as many waiting characters as fit into the transmit FIFO, if it is empty, and asks for an
+ * interrupt when it empties again only while more characters are waiting. tx_lock must be held.
+ */
+static void serial_fill() {
+  if (inb(COM1 + UART_LSR) & LSR_THR_EMPTY) {
+    for (int i = 0; i < UART_FIFO_SIZE && tx_count > 0; i++) {
+      outb(COM1 + UART_DATA, tx_buffer[tx_head]);
+      tx_head = (tx_head + 1) % SERIAL_BUFFER_SIZE;
+      tx_count--;
+    }
+  }
+
+  uint8_t ier = tx_count > 0 ? IER_RX | IER_TX : IER_RX;
+  if (ier != serial_ier) {
+    serial_ier = ier;
+    outb(COM1 + UART_IER, serial_ier);
+  }
+}
+
+/**
+ * Adds a character to the transmit buffer. Newlines are sent as "\r\n", and backspaces as "\b \b" so they
+ * erase the character before the cursor. tx_lock must be held.
+ * \param c The character to add.
+ * \returns true if the character fit, or false if the buffer is too full.
+ */
+static bool serial_put(char c) {
+  const char* out = &c;
+  size_t len = 1;
+  if (c == '\n') {
+    out = "\r\n";
+    len = 2;
+  } else if (c == '\b') {
+    out = "\b \b";
+    len = 3;
+  }
+  if (SERIAL_BUFFER_SIZE - tx_count < len) return false;
+
+  for (size_t i = 0; i < len; i++) {
+    tx_buffer[(tx_head + tx_count) % SERIAL_BUFFER_SIZE] = out[i];
+    tx_count++;
+  }
+  return true;
+}
+
+/**
+ * Sends a character to the port directly, waiting for the transmit FIFO to empty first. Only used once
+ * the kernel has panicked.
+ * \param c The character to send.
+ */
+static void serial_poll_put(char c) {
+  while (!(inb(COM1 + UART_LSR) & LSR_THR_EMPTY)) __asm__ volatile("pause");
+  outb(COM1 + UART_DATA, c);
+}
+
+/**
+ * Queues characters to send over the serial port. The port sends them from its interrupt handler.
+ * Newlines are sent as "\r\n", and backspaces erase the character before the cursor. Characters are
+ * queued SERIAL_CHUNK at a time, with interrupts back on in between, so a long write never keeps them
+ * off for long. When the transmit buffer is full, a caller with interrupts enabled waits for the port to
+ * take more; one with interrupts disabled, such as an interrupt handler, drops the rest. After
+ * serial_panic, characters are sent straight to the port instead.
+ * \param buf The characters to send.
+ * \param len The number of characters to send.
+ */
+void serial_write(const char* buf, size_t len) {
+  if (!serial_present) return;
+
+  if (serial_panicked) {
+    for (size_t i = 0; i < len; i++) {
+      if (buf[i] == '\n') serial_poll_put('\r');
+      serial_poll_put(buf[i]);
+      if (buf[i] == '\b') {
+        serial_poll_put(' ');
+        serial_poll_put('\b');
+      }
+    }
+    return;
+  }
+
+  size_t i = 0;
+  while (i < len) {
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    size_t end = len - i > SERIAL_CHUNK ? i + SERIAL_CHUNK : len;
+    while (i < end && serial_put(buf[i])) i++;
+    bool full = i < end;
+    serial_fill();
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    if (full) {
+      // Nothing drains the buffer while interrupts are off, and waiting on the port would keep them off
+      if (!(flags & FLAGS_IF)) return;
+      // Otherwise the transmit interrupt, or serial_fill above, makes room once the FIFO empties
+      while (!(inb(COM1 + UART_LSR) & LSR_THR_EMPTY)) __asm__ volatile("pause");
+    }
+  }
+}
+
+/**
+ * Makes every later serial_write wait on the port instead of queueing, so the last messages before the
+ * kernel halts get out even with interrupts off, and even if the CPU stopped while holding the lock.
+ */
+void serial_panic() {
+  serial_panicked = true;
+}
+
+/**
+ * Handles an interrupt from the UART, receiving characters and refilling the transmit FIFO. Called
+ * from the IRQ4 handler.
+ */
+void serial_interrupt() {
+  // Reading the interrupt identification register acknowledges a transmit interrupt
+  inb(COM1 + UART_IIR);
+
+  // Terminals send a carriage return for enter and DEL for backspace
+  while (inb(COM1 + UART_LSR) & LSR_DATA_READY) {
+    char c = inb(COM1 + UART_DATA);
+    if (c == '\r') c = '\n';
+    else if (c == 0x7F) c = '\b';
+    add_to_buffer(c);
+  }
+
+  uint64_t flags = spin_lock_irqsave(&tx_lock);
+  serial_fill();
+  spin_unlock_irqrestore(&tx_lock, flags);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// The first serial port's I/O ports and IRQ
+#define COM1 0x3F8
+#define COM1_IRQ 4
+
+// The number of characters buffered in each direction
+#define SERIAL_BUFFER_SIZE 4096
+
+/**
+ * Sets up the COM1 UART at 115200 baud, 8N1, with its FIFOs and interrupts on. Received characters are
+ * passed to the keyboard buffer, so reads take input from the serial port and the keyboard alike.
+ * Must be called after the PICs are initialized.
+ * \returns true on success, or false if there is no working UART.
+ */
+bool serial_init();
+
+/**
+ * Queues characters to send over the serial port. The port sends them from its interrupt handler.
+ * Newlines are sent as "\r\n", and backspaces erase the character before the cursor. Characters are
+ * queued SERIAL_CHUNK at a time, with interrupts back on in between, so a long write never keeps them
+ * off for long. When the transmit buffer is full, a caller with interrupts enabled waits for the port to
+ * take more; one with interrupts disabled, such as an interrupt handler, drops the rest. After
+ * serial_panic, characters are sent straight to the port instead.
+ * \param buf The characters to send.
+ * \param len The number of characters to send.
+ */
+void serial_write(const char* buf, size_t len);
+
+/**
+ * Makes every later serial_write wait on the port instead of queueing, so the last messages before the
+ * kernel halts get out even with interrupts off, and even if the CPU stopped while holding the lock.
+ */
+void serial_panic();
+
+/**
+ * Handles an interrupt from the UART, receiving characters and refilling the transmit FIFO. Called
+ * from the IRQ4 handler.
+ */
+void serial_interrupt();
@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <strlib.h>
+
+#include "smp.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "page.h"
+#include "boot.h"
+#include "kprint.h"
+#include "process.h"
+#include "lapic.h"
+#include "spinlock.h"
+
+#define SMP_TAG_ID 0x34d1d96339647025
+
+_Static_assert(offsetof(cpu_t, syscall_stack) == CPU_SYSCALL_STACK_OFFSET, "syscall_entry.s expects syscall_stack here");
+_Static_assert(offsetof(cpu_t, user_sp) == CPU_USER_SP_OFFSET, "syscall_entry.s expects user_sp here");
+
+// Per-CPU data, indexed by CPU number
+cpu_t cpus[MAX_CPUS];
+
+// The number of CPUs that have finished starting up
+volatile uint32_t cpus_online = 0;
+
+// Set once the kernel's page tables are final, so the application processors can enable their TLB features
+volatile bool cpus_released = false;
+
+// The big kernel lock, and the index of the CPU holding it or -1
+spinlock_t big_kernel_lock;
+volatile int32_t kernel_lock_owner = -1;
+
+// The EFER value of the bootstrap processor, so the other processors match its no-execute setting
+uint64_t bsp_efer = 0;
+
+/**
+ * Points the running CPU's GS base at its per-CPU data. User code starts with a GS base of 0, which the
+ * first swapgs into ring 3 takes from MSR_KERNEL_GS_BASE.
+ * \param cpu The running CPU's data.
+ */
+static void cpu_set_gs(cpu_t* cpu) {
+  cpu->self = cpu;
+  wrmsr(MSR_GS_BASE, (uintptr_t) cpu);
+  wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+/**
+ * Sets up the bootstrap processor's per-CPU data. Must be called before anything uses this_cpu.
+ */
+void smp_init_bsp() {
+  memset(&cpus[0], 0, sizeof(cpu_t));
+  cpus[0].id = 0;
+  cpu_set_gs(&cpus[0]);
+  cpus_online = 1;
+}
+
+/**
+ * The first code an application processor runs in the kernel. Sets up its descriptor tables and
+ * per-CPU data, then becomes the CPU's idle process once the scheduler is ready.
+ * \param info The processor's entry in the bootloader's SMP tag.
+ */
+static void ap_entry(struct stivale2_smp_info* info) {
+  cpu_t* cpu = (cpu_t*) info->extra_argument;
+  cpu_set_gs(cpu);
+  gdt_setup(cpu->id, cpu->stack_top);
+  idt_load();
+
+  // Match the bootstrap processor's write protection and no-execute settings
+  write_cr0(read_cr0() | CR0_WP);
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | (bsp_efer & EFER_NXE));
+
+  __atomic_fetch_add(&cpus_online, 1, __ATOMIC_SEQ_CST);
+
+  // Global pages and PCIDs are turned on per CPU, once the kernel's mappings are marked global
+  while (!__atomic_load_n(&cpus_released, __ATOMIC_ACQUIRE)) __asm__ volatile("pause");
+  vm_init_cpu_tlb();
+
+  // Each CPU preempts its own processes with its local APIC timer
+  lapic_init();
+  lapic_timer_start();
+  process_run_idle();
+}
+
+/**
+ * Starts every application processor reported by the bootloader and waits for them to come online.
+ * Must be called after the physical memory allocator is initialized and before the lower half is unmapped,
+ * since the processors are parked in bootloader code until they are started.
+ * \param hdr A pointer to the stivale2 header.
+ */
+void smp_init(struct stivale2_struct* hdr) {
+  struct stivale2_struct_tag_smp* smp_tag = find_tag(hdr, SMP_TAG_ID);
+  if (smp_tag == NULL) return;
+
+  bsp_efer = rdmsr(MSR_EFER);
+  cpus[0].lapic_id = smp_tag->bsp_lapic_id;
+
+  uint32_t started = 1;
+  for (uint64_t i = 0; i < smp_tag->cpu_count; i++) {
+    struct stivale2_smp_info* info = &smp_tag->smp_info[i];
+    if (info->lapic_id == smp_tag->bsp_lapic_id) continue;
+    if (started == MAX_CPUS) {
+      kprintf("smp_init: only starting %d of %lu CPUs\n", MAX_CPUS, smp_tag->cpu_count);
+      break;
+    }
+
+    // Each processor boots on the stack it will use for interrupts
+    uintptr_t stack = pmem_alloc_order(KERNEL_STACK_ORDER);
+    if (stack == 0) {
+      kprintf("smp_init: out of memory for CPU stacks\n");
+      break;
+    }
+
+    cpu_t* cpu = &cpus[started];
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->id = started;
+    cpu->lapic_id = info->lapic_id;
+    cpu->stack_top = (uintptr_t) phys_to_vir((void*) stack) + (PAGE_SIZE << KERNEL_STACK_ORDER);
+    started++;
+
+    info->target_stack = cpu->stack_top;
+    info->extra_argument = (uint64_t) cpu;
+    // Writing the entry point is what starts the processor, so it goes last
+    __atomic_store_n(&info->goto_address, (uint64_t) ap_entry, __ATOMIC_RELEASE);
+  }
+
+  while (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) < started) __asm__ volatile("pause");
+  kprintf("%d CPUs online\n", started);
+}
+
+/**
+ * Lets the application processors finish setting up and start running processes. Must be called after
+ * vm_init_tlb, process_init and lapic_timer_calibrate.
+ */
+void smp_release() {
+  __atomic_store_n(&cpus_released, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Takes the big kernel lock, which every CPU must hold while it runs kernel code other than interrupt
+ * handlers that only touch their own data. The lock stays with the CPU across a process switch, so the
+ * process switched to releases it when it leaves the kernel.
+ */
+void kernel_lock() {
+  spin_lock(&big_kernel_lock);
+  kernel_lock_owner = this_cpu()->id;
+}
+
+/**
+ * Takes the big kernel lock if no other CPU holds it.
+ * \returns true if the lock was taken.
+ */
+bool kernel_trylock() {
+  if (!spin_trylock(&big_kernel_lock)) return false;
+  kernel_lock_owner = this_cpu()->id;
+  return true;
+}
+
+/**
+ * Releases the big kernel lock.
+ */
+void kernel_unlock() {
+  kernel_lock_owner = -1;
+  spin_unlock(&big_kernel_lock);
+}
+
+/**
+ * Checks if the running CPU holds the big kernel lock.
+ * \returns true if it does.
+ */
+bool kernel_lock_held() {
+  return kernel_lock_owner == (int32_t) this_cpu()->id;
+}
+
+/**
+ * Gets the number of CPUs that are online.
+ * \returns The number of CPUs, including the bootstrap processor.
+ */
+uint32_t cpu_count() {
+  return cpus_online;
+}
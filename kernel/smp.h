@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stivale2.h"
+
+// The largest number of CPUs the kernel will start
+#define MAX_CPUS 32
+
+// Data that belongs to one CPU. While a CPU runs kernel code, its GS base points at its own block. User code
+// can change the GS base, so while it runs the block's address waits in MSR_KERNEL_GS_BASE, and every entry
+// from and return to ring 3 swaps the two with swapgs.
+typedef struct cpu {
+  // Points back at this block, so this_cpu can load it through %gs
+  struct cpu* self;
+  // The index of this CPU in the cpus array; CPU 0 is the bootstrap processor
+  uint32_t id;
+  uint32_t lapic_id;
+  // The process running on this CPU
+  struct process* running;
+  // The top of the stack this CPU uses for interrupts when no process is running
+  uintptr_t stack_top;
+  // The round of PCIDs this CPU's TLB has been flushed for, compared against the allocator's round by vm_switch
+  uint64_t pcid_generation;
+  // The kernel stack syscall_fast_entry switches to, and where it keeps the user stack pointer meanwhile
+  uintptr_t syscall_stack;
+  uintptr_t user_sp;
+} cpu_t;
+
+// Offsets of the fields syscall_entry.s reaches through %gs, after swapgs
+#define CPU_SYSCALL_STACK_OFFSET 40
+#define CPU_USER_SP_OFFSET 48
+
+/**
+ * Gets the block of per-CPU data for the CPU running this code.
+ * \returns A pointer to the running CPU's data.
+ */
+static inline cpu_t* this_cpu() {
+  cpu_t* cpu;
+  __asm__ volatile("mov %%gs:0, %0" : "=r" (cpu));
+  return cpu;
+}
+
+/**
+ * Sets up the bootstrap processor's per-CPU data. Must be called before anything uses this_cpu.
+ */
+void smp_init_bsp();
+
+/**
+ * Starts every application processor reported by the bootloader and waits for them to come online.
+ * Must be called after the physical memory allocator is initialized and before the lower half is unmapped,
+ * since the processors are parked in bootloader code until they are started.
+ * \param hdr A pointer to the stivale2 header.
+ */
+void smp_init(struct stivale2_struct* hdr);
+
+/**
+ * Lets the application processors finish setting up and start running processes. Must be called after
+ * vm_init_tlb, process_init and lapic_timer_calibrate.
+ */
+void smp_release();
+
+/**
+ * Takes the big kernel lock, which every CPU must hold while it runs kernel code other than interrupt
+ * handlers that only touch their own data. The lock stays with the CPU across a process switch, so the
+ * process switched to releases it when it leaves the kernel.
+ */
+void kernel_lock();
+
+/**
+ * Takes the big kernel lock if no other CPU holds it.
+ * \returns true if the lock was taken.
+ */
+bool kernel_trylock();
+
+/**
+ * Releases the big kernel lock.
+ */
+void kernel_unlock();
+
+/**
+ * Checks if the running CPU holds the big kernel lock.
+ * \returns true if it does.
+ */
+bool kernel_lock_held();
+
+/**
+ * Gets the number of CPUs that are online.
+ * \returns The number of CPUs, including the bootstrap processor.
+ */
+uint32_t cpu_count();
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A lock that waits by spinning. Must not be held across anything that waits for another CPU.
+typedef struct spinlock {
+  volatile uint32_t locked;
+} spinlock_t;
+
+/**
+ * Takes a spinlock, spinning until it is free. Only reads the lock while waiting, so waiting CPUs
+ * don't keep pulling its cache line away from the holder.
+ * \param lock The lock.
+ */
+static inline void spin_lock(spinlock_t* lock) {
+  while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) __asm__ volatile("pause");
+  }
+}
+
+/**
+ * Takes a spinlock if it is free.
+ * \param lock The lock.
+ * \returns true if the lock was taken.
+ */
+static inline bool spin_trylock(spinlock_t* lock) {
+  return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Releases a spinlock.
+ * \param lock The lock.
+ */
+static inline void spin_unlock(spinlock_t* lock) {
+  __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// The interrupt flag in the flags spin_lock_irqsave returns
+#define FLAGS_IF 0x200
+
+/**
+ * Takes a spinlock with interrupts disabled, for locks that interrupt handlers also take. Otherwise an
+ * interrupt arriving while the lock is held could spin on it forever.
+ * \param lock The lock.
+ * \returns The flags to hand back to spin_unlock_irqrestore.
+ */
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+  spin_lock(lock);
+  return flags;
+}
+
+/**
+ * Releases a spinlock taken with spin_lock_irqsave, enabling interrupts again if they were enabled before.
+ * \param lock The lock.
+ * \param flags The flags spin_lock_irqsave returned.
+ */
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+  spin_unlock(lock);
+  __asm__ volatile("pushq %0; popfq" : : "r"(flags) : "memory", "cc");
+}
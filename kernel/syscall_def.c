@@ -2,129 +2,310 @@
 #include <strlib.h>
 #include <stdbool.h>
 #include <elf.h>
+#include <stdlib.h>
+#include <syscalls.h>
 
 #include "page.h"
 #include "kprint.h"
-#include "key.h"
+#include "tty.h"
 #include "loader.h"
+#include "vma.h"
+#include "process.h"
+#include "cpu.h"
+#include "smp.h"
+#include "syscall_def.h"
+#include "ring.h"
+#include "log.h"
 
-#define BACKSPACE 8
+// The most characters sys_write copies onto the kernel stack at once
+#define WRITE_CHUNK 256
 
-// Stores location where mmap will map a page with no desired location.
-uintptr_t mmap_next_start = 0x9000000000;
+#ifdef EXEC_BENCHMARK
+// Build with -DEXEC_BENCHMARK to print how long each exec -> exit -> shell round trip takes
+#define BENCHMARK_START() uint64_t benchmark_start = rdtsc()
+#define BENCHMARK_END() kprintf("exec round trip: %lu cycles\n", rdtsc() - benchmark_start)
+#else
+#define BENCHMARK_START()
+#define BENCHMARK_END()
+#endif
 
 /**
 * Reads characters from a specified file and places them in a buffer. Internal/system call version.
 * 
 * \param fd The file descriptor to read from. Should be 0.
-* \param buf A pointer to store read characters in.
-* \param count The number of character to read.
-* \returns The number of characters read.
+* \param buf A pointer to store read characters in. Must be in user memory.
+* \param count The number of character to read. In the terminal's canonical mode, a read returns at most one
+*              line, once it is complete; in raw mode, it returns as soon as any input is available.
+* \returns The number of characters read, including the newline character, or -1 if fd is invalid or buf
+*          is not in user memory.
 */
-int64_t sys_read(int16_t fd, void *buf, uint16_t count) {
-  int64_t num_read = 0;
-  char* result_buf = (char*) buf;
-  // Check that fd is 0
-  if (fd != 0) {
-    // Return -1 if an invalid file descriptor was provided
+int64_t sys_read(int64_t fd, void *buf, size_t count) {
+  // Check that fd is 0, and that buf is user memory
+  if (fd != 0 || !vm_is_user_range((uintptr_t) buf, count)) {
+    // Return -1 if an invalid file descriptor or buffer was provided
     return -1;
   }
-  char current;
-  while (num_read < count) {
-    // get a character
-    current = kgetc();
-    // handle backspace
-    if (current == BACKSPACE) {
-      // do nothing if the buffer is empty
-      if (num_read == 0) {
-        continue;
-      // else drop the most recently entered character
-      } else {
-        num_read--;
-        result_buf[num_read] = '\0';
-        continue;
-      }
-    }
-    result_buf[num_read] = current;
-    num_read++;
-  }
-  return num_read;
+  return tty_read((char*) buf, count);
 }
 
 /**
 * Writes characters from a buffer to a specified file. Internal/system call version.
+* The characters are copied to the kernel stack a chunk at a time before they are printed, so a fault
+* on the buffer never happens with a console lock held.
 * 
 * \param fd The file descriptor to read from. Should be 1 or 2.
-* \param buf The buffer to write from.
+* \param buf The buffer to write from. Must be in user memory.
 * \param count The number of character to write.
-* \returns The number of characters written.
+* \returns The number of characters written, or -1 if fd is invalid or buf is not in user memory.
 */
-int64_t sys_write(int16_t fd, const void *buf, uint16_t count) {
-  int64_t num_written = 0;
-  char* cursor = (char*) buf;
-  // Check that fd is 1 or 2
-  if (fd == 1 || fd == 2) {
-    while (num_written < count) {
-    kprint_c(cursor[num_written++]);
+int64_t sys_write(int64_t fd, const void *buf, size_t count) {
+  // Check that fd is 1 or 2, and that buf is user memory
+  if ((fd != 1 && fd != 2) || !vm_is_user_range((uintptr_t) buf, count)) {
+    return -1;
   }
-    return num_written;
+  char chunk[WRITE_CHUNK];
+  for (size_t i = 0; i < count; i += WRITE_CHUNK) {
+    size_t len = count - i > WRITE_CHUNK ? WRITE_CHUNK : count - i;
+    memcpy(chunk, (const char*) buf + i, len);
+    console_write(chunk, len);
   }
-  // Return -1 if an invalid file descriptor was provided
-  return -1;
+  return count;
 }
 
 /** Maps a new page into the virtual address space of the calling process. Internal/system call version.
-* If addr is NULL, mmap chooses a page-aligned location to place the mapping.
+* If addr is NULL, mmap chooses a page-aligned location to place the mapping. The range is only reserved here;
+* each page is backed by a zeroed frame the first time it is touched.
 * \param addr The desired address at which the mapping should begin.
 * \param length The desired length of the mapping, in bytes. Rounded up to the next page internally.
-* \param prot Permissions to associate with the mapping. Defined above.
-* \param flags Flags to associate with the mapping. Disregarded in this simple implementation.
+* \param prot Permissions to associate with the mapping. Defined in stdlib.h.
+* \param flags Flags to associate with the mapping. MAP_HUGETLB backs the mapping with 2 MiB pages, or 1 GiB pages
+*              if MAP_HUGE_1GB is also set. Other flags are disregarded in this simple implementation.
 * \param fd Contents of the mapping to add. Disregarded in this simple implementation.
 * \param offset Offset into the file at which the mapping should begin. Disregarded in this simple implementation.
-* \returns A pointer to the start of the mapped region.
+* \returns A pointer to the start of the mapped region, or -1 if the region is not in user memory or cannot be reserved.
 */
-int64_t sys_mmap(void* addr, size_t length, int prot, int flags, int fd, uint16_t offset) {
+int64_t sys_mmap(void* addr, size_t length, int64_t prot, int64_t flags, int64_t fd, uint64_t offset) {
   if (length <= 0) return -1; // length must be greater than 0
+
+  // Pick the size of the pages backing the mapping
+  uint64_t page_size = PAGE_SIZE;
+  if (flags & MAP_HUGETLB) {
+    page_size = (flags & MAP_HUGE_1GB) ? PAGE_SIZE_1G : PAGE_SIZE_2M;
+    if (page_size == PAGE_SIZE_1G && !cpu_has_1g_pages()) return -1;
+  }
+
   uintptr_t address_to_map;
+  process_t* proc = current_process();
   if (addr == NULL) {
-    address_to_map = mmap_next_start;
+    // Use the next free location, aligned to the page size
+    address_to_map = (proc->mmap_next_start + page_size - 1) & ~(page_size - 1);
   } else {
     address_to_map = (uintptr_t) addr;
+    if (address_to_map % page_size != 0) return -1;
   }
   uintptr_t result = address_to_map;
-  int64_t size_left = length;
-  do {
-    //kprintf("loop, address_to_map: %p\n", address_to_map);
-    // Allocate a requested page, set permissions to requested permissions
-    if (vm_map(read_cr3(), address_to_map, 1, ((flags & 0x2) >> 1), ~(flags & 0x1) & 0x1) == false) {
-      // Return -1 if the mapping failed
-      return -1;
-    }
-    // Advance to the next possible page to allocate
-    mmap_next_start += PAGE_SIZE;
-    if (addr == NULL) address_to_map = mmap_next_start;
-    size_left -= PAGE_SIZE;
-  } while (size_left > 0);
+  bool writable = (prot & PROT_WRITE) != 0;
+  bool no_execute = (prot & PROT_EXEC) == 0;
+  uint64_t rounded_length = (length + page_size - 1) & ~(page_size - 1);
+
+  // Only reserve the range; pages are mapped and zeroed by the page fault handler when they are first touched
+  if (!vma_reserve(&proc->vmas, address_to_map, rounded_length, page_size, writable, no_execute)) return -1;
+  address_to_map += rounded_length;
+
+  // Later mappings without a requested location go after this one
+  if (addr == NULL) proc->mmap_next_start = address_to_map;
   return result;
 }
 
 /**
-* Loads a process. Internal/system call version.
+* Runs a program in a new process and waits for it to exit. The calling process keeps its address space
+* and resumes once the program is done. Internal/system call version.
 * 
-* \param name The name of the process to load.
-* \returns -1, since if this point is reached the process was not loaded.
+* \param name The name of the program to run.
+* \returns The low 8 bits of the program's exit code, or -1 if the program was not found, -2 if it was
+* not executable, or -3 if memory ran out.
 */
 int64_t sys_exec(char* name) {
-  run_exec_elf(name, get_modules_tag());
-  return -1;
+  BENCHMARK_START();
+  process_t* child;
+  int32_t rc = process_spawn(name, &child);
+  if (rc < 0) return rc;
+  uint64_t code = process_wait(child);
+  BENCHMARK_END();
+  return code & 0xFF;
 }
 
-/** Terminates the calling process by loading the kernel's init program. Should be called by all processes
+/** Terminates the calling process and resumes the process that started it. Should be called by all processes
 * that terminate using this kernel. Internal/system call version.
 * \param ex The error code that the process exits with.
 * \returns nothing in normal execution, or -1 if the internal system call failed.
 */
 int64_t sys_exit(uint64_t ex) {
-  sys_exec("init");
+  process_exit(ex);
+  return -1;
+}
+
+/** Creates a copy of the calling process that shares its memory copy-on-write. Internal/system call version.
+* \returns The child's process ID in the parent, 0 in the child, or -1 on error.
+*/
+int64_t sys_fork() {
+  return process_fork();
+}
+
+/** Maps a submission ring and a completion ring into the calling process. Operations queued on the
+* submission ring run when the process calls ring_enter, or on timer ticks with RING_POLL. Internal/system
+* call version.
+* \param flags RING_POLL or 0.
+* \returns The address of the rings, or -1 if the process already has rings or memory ran out.
+*/
+int64_t sys_ring_setup(uint64_t flags) {
+  process_t* proc = current_process();
+  if (proc->ring != NULL) return -1;
+
+  // The rings are ordinary anonymous memory, so they are backed on first touch and copied by fork
+  int64_t address = sys_mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (address < 0) return -1;
+  proc->ring = (ring_t*) address;
+  proc->ring_sq_head = 0;
+  proc->ring_cq_tail = 0;
+  proc->ring_poll = (flags & RING_POLL) != 0;
+  return address;
+}
+
+/** Runs every operation queued on the calling process's submission ring, unless the completion ring
+* fills up first. Internal/system call version.
+* \returns The number of operations run, or -1 if the process has no rings.
+*/
+int64_t sys_ring_enter() {
+  process_t* proc = current_process();
+  if (proc->ring == NULL) return -1;
+  return ring_drain(proc, true);
+}
+
+/** Copies the newest entries in the kernel log, oldest first. Internal/system call version.
+* \param buf The array to copy to.
+* \param count The number of entries buf has room for.
+* \returns The number of entries copied, or -1 if the buffer is not in user memory.
+*/
+int64_t sys_readlog(log_entry_t* buf, uint64_t count) {
+  // log_read never copies more than the log holds, so only that much of buf needs checking
+  if (count > LOG_ENTRIES) count = LOG_ENTRIES;
+  if (!vm_is_user_range((uintptr_t) buf, count * sizeof(log_entry_t))) return -1;
+  return log_read(buf, count);
+}
+
+/** Reads or changes the terminal's mode. Internal/system call version.
+* \param fd The terminal's file descriptor, 0, 1 or 2.
+* \param request TTY_GET_MODE or TTY_SET_MODE.
+* \param arg The new mode for TTY_SET_MODE, made of TTY_CANONICAL and TTY_ECHO.
+* \returns The mode for TTY_GET_MODE, 0 for TTY_SET_MODE, or -1 on error.
+*/
+int64_t sys_ioctl(int64_t fd, uint64_t request, uint64_t arg) {
+  if (fd < 0 || fd > 2) return -1;
+  if (request == TTY_GET_MODE) return tty_get_mode();
+  if (request == TTY_SET_MODE) return tty_set_mode(arg) ? 0 : -1;
   return -1;
 }
+
+// A system call handler, called with the six argument registers of the call
+typedef int64_t (*syscall_fn_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+// The arguments each sys_ function takes, converted from the argument registers a0 to a5. Handlers have
+// no integer parameters narrower than 64 bits, so user values are never silently truncated.
+#define SYSCALL_ARGS_read a0, (void*) a1, a2
+#define SYSCALL_ARGS_write a0, (const void*) a1, a2
+#define SYSCALL_ARGS_mmap (void*) a0, a1, a2, a3, a4, a5
+#define SYSCALL_ARGS_exec (char*) a0
+#define SYSCALL_ARGS_exit a0
+#define SYSCALL_ARGS_fork
+#define SYSCALL_ARGS_stats (syscall_stats_t*) a0, a1
+#define SYSCALL_ARGS_ring_setup a0
+#define SYSCALL_ARGS_ring_enter
+#define SYSCALL_ARGS_readlog (log_entry_t*) a0, a1
+#define SYSCALL_ARGS_ioctl a0, a1, a2
+
+// A syscall_fn_t for each sys_ function, so every handler is called through its own type
+#define SYSCALL_WRAPPER(nr, name) \
+  static int64_t syscall_handle_##name(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5) { \
+    return sys_##name(SYSCALL_ARGS_##name); \
+  }
+SYSCALL_LIST(SYSCALL_WRAPPER)
+#undef SYSCALL_WRAPPER
+
+// The handler for each system call, indexed by number
+#define SYSCALL_HANDLER(nr, name) [nr] = syscall_handle_##name,
+syscall_fn_t syscall_table[NUM_SYSCALLS] = {
+  SYSCALL_LIST(SYSCALL_HANDLER)
+};
+#undef SYSCALL_HANDLER
+
+// How often each system call has been made and how long it took. Updated with the kernel lock held.
+syscall_stats_t syscall_stats[NUM_SYSCALLS];
+
+/**
+ * Records how long a system call took.
+ * \param nr The system call number.
+ * \param cycles The number of cycles the call took.
+ */
+static void syscall_record(uint64_t nr, uint64_t cycles) {
+  syscall_stats_t* stats = &syscall_stats[nr];
+  stats->count++;
+  stats->cycles += cycles;
+
+  // The bucket is the index of the highest set bit
+  int bucket = cycles == 0 ? 0 : 63 - __builtin_clzll(cycles);
+  if (bucket >= SYSCALL_HISTOGRAM_BUCKETS) bucket = SYSCALL_HISTOGRAM_BUCKETS - 1;
+  stats->histogram[bucket]++;
+}
+
+/** Copies the counters of every system call into a buffer. Internal/system call version.
+* \param buf The buffer to copy to, with room for count entries indexed by system call number.
+* \param count The number of entries the buffer holds.
+* \returns The number of entries copied, which is at most the number of system calls, or -1 if the buffer
+* is not in user memory.
+*/
+int64_t sys_stats(syscall_stats_t* buf, uint64_t count) {
+  if (count > NUM_SYSCALLS) count = NUM_SYSCALLS;
+  if (!vm_is_user_range((uintptr_t) buf, count * sizeof(syscall_stats_t))) return -1;
+  memcpy(buf, syscall_stats, count * sizeof(syscall_stats_t));
+  return count;
+}
+
+/**
+ * Runs the handler for a system call and records how long it took. The kernel lock must be held.
+ * \param nr The system call number, which must be less than NUM_SYSCALLS.
+ * \param arg0 The first argument to pass to the handler function.
+ * \param arg1 The second argument to pass to the handler function.
+ * \param arg2 The third argument to pass to the handler function.
+ * \param arg3 The fourth argument to pass to the handler function.
+ * \param arg4 The fifth argument to pass to the handler function.
+ * \param arg5 The sixth argument to pass to the handler function.
+ * \returns The value returned by the handler function.
+ */
+int64_t syscall_run(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+  uint64_t start = rdtsc();
+  int64_t rc = syscall_table[nr](arg0, arg1, arg2, arg3, arg4, arg5);
+  syscall_record(nr, rdtsc() - start);
+  return rc;
+}
+
+/**
+ * Handles system calls by looking up the handler for the system call number in syscall_table. Each call
+ * is timed and counted in syscall_stats.
+ * \param nr The system call number.
+ * \param arg0 The first argument to pass to the handler function.
+ * \param arg1 The second argument to pass to the handler function.
+ * \param arg2 The third argument to pass to the handler function.
+ * \param arg3 The fourth argument to pass to the handler function.
+ * \param arg4 The fifth argument to pass to the handler function.
+ * \param arg5 The sixth argument to pass to the handler function.
+ * \returns The value returned by the chosen handler function, or -1 if no function was chosen (invalid system call number)
+ */
+int64_t syscall_handler(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+  if (nr >= NUM_SYSCALLS) return -1;
+
+  kernel_lock();
+  int64_t rc = syscall_run(nr, arg0, arg1, arg2, arg3, arg4, arg5);
+  kernel_unlock();
+  return rc;
+}
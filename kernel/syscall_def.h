@@ -1,11 +1,42 @@
 #pragma once
 
-int64_t sys_read(int16_t fd, void *buf, uint16_t count);
+#include <stdint.h>
+#include <stddef.h>
+#include <syscalls.h>
+#include <io_ring.h>
+#include <log_entry.h>
 
-int64_t sys_write(int16_t fd, const void *buf, uint16_t count);
+int64_t sys_read(int64_t fd, void *buf, size_t count);
 
-int64_t sys_mmap(void* addr, size_t length, int prot, int flags, int fd, uint16_t offset);
+int64_t sys_write(int64_t fd, const void *buf, size_t count);
+
+int64_t sys_mmap(void* addr, size_t length, int64_t prot, int64_t flags, int64_t fd, uint64_t offset);
 
 int64_t sys_exec(char* name);
 
 int64_t sys_exit(uint64_t ex);
+
+int64_t sys_fork();
+
+int64_t sys_stats(syscall_stats_t* buf, uint64_t count);
+
+int64_t sys_ring_setup(uint64_t flags);
+
+int64_t sys_ring_enter();
+
+int64_t sys_readlog(log_entry_t* buf, uint64_t count);
+
+int64_t sys_ioctl(int64_t fd, uint64_t request, uint64_t arg);
+
+/**
+ * Runs the handler for a system call and records how long it took. The kernel lock must be held.
+ * \param nr The system call number, which must be less than NUM_SYSCALLS.
+ * \param arg0 The first argument to pass to the handler function.
+ * \param arg1 The second argument to pass to the handler function.
+ * \param arg2 The third argument to pass to the handler function.
+ * \param arg3 The fourth argument to pass to the handler function.
+ * \param arg4 The fifth argument to pass to the handler function.
+ * \param arg5 The sixth argument to pass to the handler function.
+ * \returns The value returned by the handler function.
+ */
+int64_t syscall_run(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5);
@@ -1,8 +1,36 @@
 .global syscall_entry
+.global syscall_fast_entry
 .global syscall_handler
+.global fork_return
 
-# This is the interrupt handler routine called when a system call is issued
+# Offsets into this CPU's cpu_t, which %gs points at once swapgs has run on entry from user mode (see smp.h)
+.set CPU_SYSCALL_STACK, 40
+.set CPU_USER_SP, 48
+
+# The user selectors with privilege level 3 (see gdt.h)
+.set USER_DATA, 0x3b
+.set USER_CODE, 0x43
+
+# This is the interrupt handler routine called when a system call is issued with int $0x80. Programs
+# built before the syscall instruction was supported still enter here.
 syscall_entry:
+  # Take this CPU's GS base back from user code. The handler is an interrupt gate, so nothing else can
+  # arrive before the swap; interrupts go back on once it's done.
+  testb $3, 0x8(%rsp)
+  jz 1f
+  swapgs
+1:
+  sti
+
+  # Save the user's callee-saved registers above the arguments. Together with the interrupt frame
+  # they make up the syscall_frame_t that fork copies into a child.
+  push %rbp
+  push %rbx
+  push %r12
+  push %r13
+  push %r14
+  push %r15
+
   # The %rax register holds the sixth syscall argument. Put it on the stack.
   push %rax
 
@@ -11,6 +39,98 @@ syscall_entry:
 
   # The %rax register now holds the return value. Move the stack up without overwriting %rax.
   add $0x8, %rsp
+  jmp syscall_return
+
+# This is where the syscall instruction enters the kernel, with interrupts off. The fourth argument is
+# in %r10 instead of %rcx, which holds the return address; %r11 holds the user's flags.
+syscall_fast_entry:
+  # Take this CPU's GS base back from user code before touching anything through %gs, which user code can
+  # point anywhere. Interrupts are off until the swap is done.
+  swapgs
+
+  # The syscall instruction doesn't switch stacks. Keep the user stack pointer in this CPU's data while
+  # moving to the running process's kernel stack.
+  mov %rsp, %gs:CPU_USER_SP
+  mov %gs:CPU_SYSCALL_STACK, %rsp
+
+  # Build the frame int $0x80 would have pushed, so both entries leave the same syscall_frame_t
+  pushq $USER_DATA
+  pushq %gs:CPU_USER_SP
+  push %r11
+  pushq $USER_CODE
+  push %rcx
+
+  # The user stack pointer is saved, so another process may run on this CPU from here on
+  sti
+
+  push %rbp
+  push %rbx
+  push %r12
+  push %r13
+  push %r14
+  push %r15
+  push %rax
+
+  # Move the fourth argument to where the C calling convention expects it
+  mov %r10, %rcx
+  call syscall_handler
+  add $0x8, %rsp
+
+# Returns to user mode through the syscall_frame_t at the top of the kernel stack, with %rax as the result
+syscall_return:
+  # Restore the callee-saved registers
+  pop %r15
+  pop %r14
+  pop %r13
+  pop %r12
+  pop %rbx
+  pop %rbp
+
+  # Only the interrupt frame is left. Interrupts stay off until the user stack is back, since an
+  # interrupt taken in kernel mode would land on it.
+  cli
+
+  # Clear the scratch registers the kernel used, so no kernel pointers or data reach user mode. %rcx and
+  # %r11 are cleared below, or loaded for sysretq.
+  xor %edi, %edi
+  xor %esi, %esi
+  xor %edx, %edx
+  xor %r8d, %r8d
+  xor %r9d, %r9d
+  xor %r10d, %r10d
+
+  # Hand the GS base back to user code. int $0x80 issued by the kernel returns to the kernel untouched.
+  testb $3, 0x8(%rsp)
+  jz 1f
+  swapgs
+
+  # sysretq is much cheaper than iretq, but can only return to 64-bit user code, and faults in kernel
+  # mode on a non-canonical return address
+  cmpq $USER_CODE, 0x8(%rsp)
+  jne 1f
+  mov (%rsp), %rcx
+  mov %rcx, %r11
+  shr $47, %r11
+  jnz 1f
+
+  # sysretq takes the return address from %rcx and the flags from %r11
+  mov 0x10(%rsp), %r11
+  mov 0x18(%rsp), %rsp
+  sysretq
+
+1:
+  xor %ecx, %ecx
+  xor %r11d, %r11d
+  iretq
+
+# A forked child starts here, on a kernel stack holding a copy of its parent's syscall frame
+fork_return:
+  # The child was switched to with the kernel lock held. The frame leaves the stack 8 bytes short of the
+  # 16-byte alignment calls need.
+  sub $0x8, %rsp
+  call kernel_unlock
+  add $0x8, %rsp
 
-  # Return from the interrupt handler
-  iretq
\ No newline at end of file
+  # fork returns 0 in the child
+  xor %rax, %rax
+  jmp syscall_return
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <strlib.h>
+
+#include "tty.h"
+#include "key.h"
+#include "kprint.h"
+
+// The terminal's mode, shared by every process like a single console would be
+static uint64_t tty_mode = TTY_MODE_DEFAULT;
+
+// The line being collected in canonical mode. Once tty_line_ready is set, reads take the characters
+// from tty_line_read to tty_line_len, and no more input is processed until they are all taken.
+static char tty_line[TTY_LINE_MAX];
+static size_t tty_line_len = 0;
+static size_t tty_line_read = 0;
+static bool tty_line_ready = false;
+
+// Shows input on the console if the mode asks for it
+static void tty_echo(char c) {
+  if (tty_mode & TTY_ECHO) kprint_c(c);
+}
+
+// Deletes the last character of the line being collected, and from the screen
+static void tty_erase() {
+  if (tty_line_len == 0) return;
+  tty_line_len--;
+  tty_echo('\b');
+}
+
+/**
+ * Adds a character of input to the line being collected in canonical mode, handling erase and kill.
+ * \param c The character.
+ */
+static void tty_canonical_input(char c) {
+  if (c == TTY_ERASE) {
+    tty_erase();
+    return;
+  }
+  if (c == TTY_KILL) {
+    while (tty_line_len > 0) tty_erase();
+    return;
+  }
+  tty_line[tty_line_len++] = c;
+  tty_echo(c);
+  if (c == '\n' || tty_line_len == TTY_LINE_MAX) tty_line_ready = true;
+}
+
+/**
+ * Takes characters that were already collected into the line buffer.
+ * \param buf Where to store the characters.
+ * \param count The number of characters buf has room for.
+ * \returns The number of characters taken.
+ */
+static size_t tty_take(char* buf, size_t count) {
+  size_t available = tty_line_len - tty_line_read;
+  if (count > available) count = available;
+  memcpy(buf, &tty_line[tty_line_read], count);
+  tty_line_read += count;
+
+  // Start a new line once this one is used up
+  if (tty_line_read == tty_line_len) {
+    tty_line_len = 0;
+    tty_line_read = 0;
+    tty_line_ready = false;
+  }
+  return count;
+}
+
+/**
+ * Reads input from the terminal. In canonical mode, blocks until a line is ready and returns as much of
+ * it as fits; the rest is returned by the next reads. In raw mode, blocks until a character arrives and
+ * returns it along with any others already waiting. Must be called with the kernel lock held.
+ * \param buf Where to store the characters.
+ * \param count The number of characters buf has room for.
+ * \returns The number of characters read.
+ */
+int64_t tty_read(char* buf, size_t count) {
+  if (count == 0) return 0;
+
+  if (tty_mode & TTY_CANONICAL) {
+    while (!tty_line_ready) tty_canonical_input(kgetc());
+    return tty_take(buf, count);
+  }
+
+  // Whatever was typed before switching to raw mode comes first
+  if (tty_line_len > tty_line_read) return tty_take(buf, count);
+
+  size_t num_read = 0;
+  do {
+    char c = kgetc();
+    tty_echo(c);
+    buf[num_read++] = c;
+  } while (num_read < count && key_available());
+  return num_read;
+}
+
+/**
+ * Reads the terminal's mode.
+ * \returns The mode, made of TTY_CANONICAL and TTY_ECHO.
+ */
+uint64_t tty_get_mode() {
+  return tty_mode;
+}
+
+/**
+ * Changes the terminal's mode. Characters of a line already typed in canonical mode are kept, and are
+ * the first returned by a read in raw mode.
+ * \param mode The new mode, made of TTY_CANONICAL and TTY_ECHO.
+ * \returns true on success, or false if mode has unknown flags.
+ */
+bool tty_set_mode(uint64_t mode) {
+  if (mode & ~(uint64_t) (TTY_CANONICAL | TTY_ECHO)) return false;
+  tty_mode = mode;
+  return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <tty_mode.h>
+
+/**
+ * Reads input from the terminal. In canonical mode, blocks until a line is ready and returns as much of
+ * it as fits; the rest is returned by the next reads. In raw mode, blocks until a character arrives and
+ * returns it along with any others already waiting. Must be called with the kernel lock held.
+ * \param buf Where to store the characters.
+ * \param count The number of characters buf has room for.
+ * \returns The number of characters read.
+ */
+int64_t tty_read(char* buf, size_t count);
+
+/**
+ * Reads the terminal's mode.
+ * \returns The mode, made of TTY_CANONICAL and TTY_ECHO.
+ */
+uint64_t tty_get_mode();
+
+/**
+ * Changes the terminal's mode. Characters of a line already typed in canonical mode are kept, and are
+ * the first returned by a read in raw mode.
+ * \param mode The new mode, made of TTY_CANONICAL and TTY_ECHO.
+ * \returns true on success, or false if mode has unknown flags.
+ */
+bool tty_set_mode(uint64_t mode);
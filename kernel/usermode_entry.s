@@ -1,11 +1,11 @@
 .global usermode_entry
 
 usermode_entry:
-  # Set data segment selectors (in first argument)
+  # Set data segment selectors (in first argument). %gs is left alone, since loading it would clear
+  # the GS base that points at this CPU's data.
   mov %di, %ds
   mov %di, %es
   mov %di, %fs
-  mov %di, %gs
 
   # Push the stack segment selector (in first argument)
   push %rdi
@@ -30,5 +30,10 @@ usermode_entry:
   mov 64(%rsp), %r8
   mov 72(%rsp), %r9
 
+  # Hand the GS base over to user code, keeping this CPU's data in MSR_KERNEL_GS_BASE (see smp.h). The
+  # flags pushed above still enable interrupts in user mode, but none may arrive in between here.
+  cli
+  swapgs
+
   # Use iret to jump away
   iretq
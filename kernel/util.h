@@ -1,8 +1,28 @@
 #pragma once
 
-// Halt the CPU in an infinite loop
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "page.h"
+#include "kprint.h"
+#include "log.h"
+
+// Halt the CPU in an infinite loop, after making sure whatever was printed is on the screen. The consoles
+// switch to panic mode first, so a lock held by the code that failed can't stop the flush.
 static void halt() {
+  console_panic();
+  log_flush(LOG_ENTRIES);
+  term_flush();
   while (1) {
     __asm__("hlt");
   }
 }
+
+// Loop forever, spending idle time refilling the pre-zeroed page pool and halting once it is full
+static inline void idle() {
+  while (1) {
+    if (!pmem_zero_pool_refill()) {
+      __asm__("hlt");
+    }
+  }
+}
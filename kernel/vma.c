@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vma.h"
+#include "kmem.h"
+#include "page.h"
+
+/**
+ * Reserves a range of virtual memory. No memory is mapped until the range is touched.
+ * \param list The list of reserved ranges to add to
+ * \param start The start of the range, aligned to page_size
+ * \param length The length of the range in bytes, a multiple of page_size
+ * \param page_size The size of the pages to back the range with
+ * \param writable Should the pages be writable?
+ * \param no_execute Should the pages be non-executable?
+ * \returns true on success, or false if the range is not in user memory, overlaps an existing
+ * reservation, or memory ran out.
+ */
+bool vma_reserve(vma_t** list, uintptr_t start, uint64_t length, uint64_t page_size, bool writable, bool no_execute) {
+  // The fault handler maps reserved pages as user pages, which must never land in the shared kernel half
+  if (length == 0 || !vm_is_user_range(start, length)) return false;
+  uintptr_t end = start + length;
+
+  // Find the spot that keeps the list sorted, rejecting overlaps on the way
+  vma_t** link = list;
+  while (*link != NULL && (*link)->start < end) {
+    if ((*link)->end > start) return false;
+    link = &(*link)->next;
+  }
+
+  vma_t* vma = kmalloc(sizeof(vma_t));
+  if (vma == NULL) return false;
+  vma->start = start;
+  vma->end = end;
+  vma->page_size = page_size;
+  vma->writable = writable;
+  vma->no_execute = no_execute;
+  vma->next = *link;
+  *link = vma;
+  return true;
+}
+
+/**
+ * Finds the reserved range that contains an address.
+ * \param list The list of reserved ranges
+ * \param address The address to look up
+ * \returns The range holding the address, or NULL if there is none.
+ */
+vma_t* vma_find(vma_t* list, uintptr_t address) {
+  for (vma_t* vma = list; vma != NULL && vma->start <= address; vma = vma->next) {
+    if (address < vma->end) return vma;
+  }
+  return NULL;
+}
+
+/**
+ * Drops every reservation in a list. Pages that were mapped in the ranges are not unmapped.
+ * \param list The list of reserved ranges
+ */
+void vma_clear(vma_t** list) {
+  vma_t* vma = *list;
+  while (vma != NULL) {
+    vma_t* next = vma->next;
+    kfree(vma);
+    vma = next;
+  }
+  *list = NULL;
+}
+
+/**
+ * Copies every reservation in a list, such as for a forked process.
+ * \param dst The empty list to copy into
+ * \param src The list to copy
+ * \returns true on success, or false if memory ran out. Whatever was copied is left in dst.
+ */
+bool vma_copy(vma_t** dst, vma_t* src) {
+  vma_t** link = dst;
+  for (vma_t* vma = src; vma != NULL; vma = vma->next) {
+    vma_t* copy = kmalloc(sizeof(vma_t));
+    if (copy == NULL) return false;
+    *copy = *vma;
+    copy->next = NULL;
+    *link = copy;
+    link = &copy->next;
+  }
+  return true;
+}
+
+/**
+ * Handles a page fault by mapping a zeroed page if the address is in a reserved range.
+ * \param root The physical address of the top-level page table structure
+ * \param list The list of reserved ranges
+ * \param address The faulting address, from cr2
+ * \param ec The page fault error code
+ * \returns true if the fault was handled and the access can be retried, or false otherwise.
+ */
+bool vma_handle_fault(uintptr_t root, vma_t* list, uintptr_t address, uint64_t ec) {
+  // Only missing pages are filled in; anything else is a real protection violation
+  if (ec & PF_PRESENT) return false;
+
+  vma_t* vma = vma_find(list, address);
+  if (vma == NULL) return false;
+  if ((ec & PF_WRITE) && !vma->writable) return false;
+  if ((ec & PF_INSTRUCTION) && vma->no_execute) return false;
+
+  if (vma->page_size != PAGE_SIZE) {
+    uintptr_t page = address & ~(vma->page_size - 1);
+    if (vm_map_large(root, page, vma->page_size, true, vma->writable, vma->no_execute)) return true;
+    // Fall back to a small page if there is no free block big enough
+  }
+  return vm_map(root, address & 0xFFFFFFFFFFFFF000, true, vma->writable, vma->no_execute);
+}
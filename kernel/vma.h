@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+#define PF_INSTRUCTION 0x10
+
+// A reserved range of user virtual memory. Pages in the range are mapped the first time they are touched.
+typedef struct vma {
+  uintptr_t start;
+  uintptr_t end;
+  // The size of the pages backing the range: PAGE_SIZE, PAGE_SIZE_2M or PAGE_SIZE_1G
+  uint64_t page_size;
+  bool writable;
+  bool no_execute;
+  struct vma* next;
+} vma_t;
+
+/**
+ * Reserves a range of virtual memory. No memory is mapped until the range is touched.
+ * \param list The list of reserved ranges to add to
+ * \param start The start of the range, aligned to page_size
+ * \param length The length of the range in bytes, a multiple of page_size
+ * \param page_size The size of the pages to back the range with
+ * \param writable Should the pages be writable?
+ * \param no_execute Should the pages be non-executable?
+ * \returns true on success, or false if the range is not in user memory, overlaps an existing
+ * reservation, or memory ran out.
+ */
+bool vma_reserve(vma_t** list, uintptr_t start, uint64_t length, uint64_t page_size, bool writable, bool no_execute);
+
+/**
+ * Finds the reserved range that contains an address.
+ * \param list The list of reserved ranges
+ * \param address The address to look up
+ * \returns The range holding the address, or NULL if there is none.
+ */
+vma_t* vma_find(vma_t* list, uintptr_t address);
+
+/**
+ * Drops every reservation in a list. Pages that were mapped in the ranges are not unmapped.
+ * \param list The list of reserved ranges
+ */
+void vma_clear(vma_t** list);
+
+/**
+ * Copies every reservation in a list, such as for a forked process.
+ * \param dst The empty list to copy into
+ * \param src The list to copy
+ * \returns true on success, or false if memory ran out. Whatever was copied is left in dst.
+ */
+bool vma_copy(vma_t** dst, vma_t* src);
+
+/**
+ * Handles a page fault by mapping a zeroed page if the address is in a reserved range.
+ * \param root The physical address of the top-level page table structure
+ * \param list The list of reserved ranges
+ * \param address The faulting address, from cr2
+ * \param ec The page fault error code
+ * \returns true if the fault was handled and the access can be retried, or false otherwise.
+ */
+bool vma_handle_fault(uintptr_t root, vma_t* list, uintptr_t address, uint64_t ec);
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "wait_queue.h"
+#include "process.h"
+
+// Queues signaled by interrupt handlers whose waiters haven't been woken yet, newest first
+static wait_queue_t* signaled_queues = NULL;
+
+/**
+ * Takes a process off a wait queue, if it is on it.
+ * \param queue The queue.
+ * \param proc The process.
+ */
+static void wait_queue_remove(wait_queue_t* queue, process_t* proc) {
+  for (process_t** link = &queue->waiters; *link != NULL; link = &(*link)->wait_next) {
+    if (*link == proc) {
+      *link = proc->wait_next;
+      proc->wait_next = NULL;
+      return;
+    }
+  }
+}
+
+/**
+ * Blocks the running process on a wait queue until a condition holds. The condition is checked again
+ * after the process joins the queue, so a signal that arrives in between isn't missed. Must be called
+ * with the kernel lock held, by a process that can block.
+ * \param queue The queue.
+ * \param done Checks the condition.
+ */
+void wait_queue_wait(wait_queue_t* queue, bool (*done)()) {
+  process_t* self = current_process();
+  while (!done()) {
+    self->state = PROCESS_BLOCKED;
+    self->wait_next = queue->waiters;
+    queue->waiters = self;
+
+    if (done()) {
+      wait_queue_remove(queue, self);
+      self->state = PROCESS_RUNNING;
+      return;
+    }
+    // Returns once a wake took us off the queue
+    process_block();
+  }
+}
+
+/**
+ * Wakes every process waiting on a queue. Must be called with the kernel lock held.
+ * \param queue The queue.
+ */
+void wait_queue_wake_all(wait_queue_t* queue) {
+  process_t* proc = queue->waiters;
+  queue->waiters = NULL;
+  while (proc != NULL) {
+    process_t* next = proc->wait_next;
+    proc->wait_next = NULL;
+    process_wake(proc);
+    proc = next;
+  }
+}
+
+/**
+ * Asks for every process waiting on a queue to be woken. Safe to call from interrupt handlers, since
+ * it only adds the queue to a lock-free list; wait_queue_run_signals does the waking.
+ * \param queue The queue.
+ */
+void wait_queue_signal(wait_queue_t* queue) {
+  // A queue that is already on the list will be woken anyway
+  if (__atomic_exchange_n(&queue->signaled, true, __ATOMIC_ACQ_REL)) return;
+
+  wait_queue_t* head = __atomic_load_n(&signaled_queues, __ATOMIC_RELAXED);
+  do {
+    queue->next_signaled = head;
+  } while (!__atomic_compare_exchange_n(&signaled_queues, &head, queue, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED));
+}
+
+/**
+ * Wakes the waiters of every queue signaled since the last call. Must be called with the kernel lock held.
+ */
+void wait_queue_run_signals() {
+  if (__atomic_load_n(&signaled_queues, __ATOMIC_RELAXED) == NULL) return;
+
+  wait_queue_t* queue = __atomic_exchange_n(&signaled_queues, NULL, __ATOMIC_ACQUIRE);
+  while (queue != NULL) {
+    // Once signaled is cleared, a new signal puts the queue back on the list and overwrites next_signaled
+    wait_queue_t* next = queue->next_signaled;
+    __atomic_store_n(&queue->signaled, false, __ATOMIC_RELEASE);
+    wait_queue_wake_all(queue);
+    queue = next;
+  }
+}
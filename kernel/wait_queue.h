@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct process;
+
+// Processes waiting for something to happen, such as a key being pressed. Interrupt handlers can't take
+// the kernel lock, so they signal the queue instead, and its waiters are woken the next time a CPU holds
+// the kernel lock: when any CPU schedules, or when an idle CPU wakes from halting.
+typedef struct wait_queue {
+  // The blocked processes, linked through wait_next. Only changed with the kernel lock held.
+  struct process* waiters;
+  // Is the queue on the list of signaled queues?
+  volatile bool signaled;
+  // The next queue on the list of signaled queues
+  struct wait_queue* next_signaled;
+} wait_queue_t;
+
+/**
+ * Blocks the running process on a wait queue until a condition holds. The condition is checked again
+ * after the process joins the queue, so a signal that arrives in between isn't missed. Must be called
+ * with the kernel lock held, by a process that can block.
+ * \param queue The queue.
+ * \param done Checks the condition.
+ */
+void wait_queue_wait(wait_queue_t* queue, bool (*done)());
+
+/**
+ * Wakes every process waiting on a queue. Must be called with the kernel lock held.
+ * \param queue The queue.
+ */
+void wait_queue_wake_all(wait_queue_t* queue);
+
+/**
+ * Asks for every process waiting on a queue to be woken. Safe to call from interrupt handlers, since
+ * it only adds the queue to a lock-free list; wait_queue_run_signals does the waking.
+ * \param queue The queue.
+ */
+void wait_queue_signal(wait_queue_t* queue);
+
+/**
+ * Wakes the waiters of every queue signaled since the last call. Must be called with the kernel lock held.
+ */
+void wait_queue_run_signals();
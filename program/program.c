@@ -15,12 +15,12 @@ void _start() {
 
   // Test writing to memory obtained from mmap
   printf("Input to program: ");
-  read(0, test, 5);
+  size_t count = fread(test, 1, 5, stdin);
   printf("\n");
   test[6] = '\0';
   // Echo input to terminal
   printf("program read: ");
-  write(1, test, 5);
+  fwrite(test, 1, count, stdout);
   printf("\n");
 
   exit(0);
@@ -1,3 +1,8 @@
 #!/bin/bash
 
-qemu-system-x86_64 -m 2G -cdrom boot.iso
+# Set SMP to choose the number of CPUs, and HEADLESS=1 to use the serial console from this terminal
+# without opening a display
+if [ -n "$HEADLESS" ]; then
+  DISPLAY_ARGS="-serial stdio -display none"
+fi
+qemu-system-x86_64 -m 2G -smp ${SMP:-1} -cdrom boot.iso $DISPLAY_ARGS
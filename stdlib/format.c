@@ -0,0 +1,294 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <strlib.h>
+
+#include "stdio.h"
+
+// Conversion flags
+#define FORMAT_LEFT 0x1
+#define FORMAT_ZERO 0x2
+#define FORMAT_PLUS 0x4
+#define FORMAT_SPACE 0x8
+#define FORMAT_ALT 0x10
+
+// The most digits a 64-bit integer takes, in octal
+#define FORMAT_DIGITS_MAX 22
+
+// The decimal digits of 0 to 99, two characters each, so numbers are converted two digits per division
+static const char format_digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Where formatted output goes. len counts every character, including those that didn't fit.
+typedef struct format_out {
+  char* buf;
+  size_t size;
+  size_t len;
+} format_out_t;
+
+/**
+* Adds characters to the output, dropping whatever doesn't fit. The last byte of the buffer is kept
+* for the null terminator.
+* \param out The output.
+* \param str The characters to add.
+* \param len The number of characters.
+*/
+static void format_put(format_out_t* out, const char* str, size_t len) {
+  if (out->len + 1 < out->size) {
+    size_t room = out->size - 1 - out->len;
+    memcpy(&out->buf[out->len], str, len < room ? len : room);
+  }
+  out->len += len;
+}
+
+/**
+* Adds a character to the output several times.
+* \param out The output.
+* \param c The character to add.
+* \param count The number of times to add it.
+*/
+static void format_fill(format_out_t* out, char c, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (out->len + 1 < out->size) out->buf[out->len] = c;
+    out->len++;
+  }
+}
+
+/**
+* Converts an unsigned integer to digits, filling a buffer from its end.
+* \param end The end of the buffer, which must hold FORMAT_DIGITS_MAX characters.
+* \param value The value to convert.
+* \param base 8, 10 or 16.
+* \param upper Use uppercase letters for hexadecimal digits?
+* \returns A pointer to the first digit.
+*/
+static char* format_digits(char* end, uint64_t value, int base, bool upper) {
+  char* p = end;
+  if (base == 10) {
+    // Two digits at a time from the table, then the last one or two
+    while (value >= 100) {
+      const char* pair = &format_digit_pairs[(value % 100) * 2];
+      value /= 100;
+      *--p = pair[1];
+      *--p = pair[0];
+    }
+    if (value >= 10) {
+      *--p = format_digit_pairs[value * 2 + 1];
+      *--p = format_digit_pairs[value * 2];
+    } else {
+      *--p = '0' + value;
+    }
+  } else {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    int shift = base == 16 ? 4 : 3;
+    do {
+      *--p = digits[value & (base - 1)];
+      value >>= shift;
+    } while (value != 0);
+  }
+  return p;
+}
+
+/**
+* Adds a converted integer to the output with its sign or prefix, precision and padding.
+* \param out The output.
+* \param digits The integer's digits.
+* \param num_digits The number of digits.
+* \param prefix The sign or prefix to put before the digits, such as "-" or "0x", or "".
+* \param flags The conversion flags.
+* \param width The minimum width, or 0.
+* \param precision The minimum number of digits, or -1 if none was given.
+*/
+static void format_integer(format_out_t* out, const char* digits, size_t num_digits, const char* prefix,
+                           int flags, size_t width, int precision) {
+  // A precision of 0 prints nothing for 0
+  if (precision == 0 && num_digits == 1 && digits[0] == '0') num_digits = 0;
+  size_t zeros = precision > 0 && (size_t) precision > num_digits ? precision - num_digits : 0;
+  size_t prefix_len = stringlen(prefix);
+  size_t len = prefix_len + zeros + num_digits;
+
+  // Zero padding goes between the prefix and the digits, and is ignored with a precision
+  size_t pad = width > len ? width - len : 0;
+  if ((flags & FORMAT_ZERO) && !(flags & FORMAT_LEFT) && precision < 0) {
+    zeros += pad;
+    pad = 0;
+  }
+
+  if (!(flags & FORMAT_LEFT)) format_fill(out, ' ', pad);
+  format_put(out, prefix, prefix_len);
+  format_fill(out, '0', zeros);
+  format_put(out, digits, num_digits);
+  if (flags & FORMAT_LEFT) format_fill(out, ' ', pad);
+}
+
+/**
+* Formats a string into a buffer. This is the engine behind printf, snprintf and kprintf. Conversions
+* take the form %[flags][width][.precision][length]conversion, where:
+* flags: '-' left-justifies, '0' pads numbers with zeros, '+' and ' ' put a sign before positive numbers,
+*        '#' puts 0x before nonzero hexadecimal numbers and 0 before octal ones
+* width, precision: a number, or '*' to take it from the next argument
+* length: hh, h, l, ll, z or j for integer arguments of other sizes than int
+* conversion: d and i (signed), u, x, X and o (unsigned), c, s, p, or % for a literal '%'
+* Unknown conversions print "<not supported>".
+* \param buf The buffer to format into. At most size - 1 characters are written, then a null terminator.
+* \param size The size of the buffer. May be 0, to only measure the result.
+* \param format The string to format.
+* \param args The values to format.
+* \returns The length of the formatted string, which is size or more if it was cut off.
+*/
+int vsnprintf(char* buf, size_t size, const char* format, va_list args) {
+  format_out_t out = {buf, size, 0};
+  char digits[FORMAT_DIGITS_MAX];
+  char* digits_end = digits + FORMAT_DIGITS_MAX;
+
+  const char* p = format;
+  while (*p != '\0') {
+    // Copy everything up to the next conversion at once
+    if (*p != '%') {
+      const char* start = p;
+      while (*p != '\0' && *p != '%') p++;
+      format_put(&out, start, p - start);
+      continue;
+    }
+    p++;
+
+    int flags = 0;
+    for (;; p++) {
+      if (*p == '-') flags |= FORMAT_LEFT;
+      else if (*p == '0') flags |= FORMAT_ZERO;
+      else if (*p == '+') flags |= FORMAT_PLUS;
+      else if (*p == ' ') flags |= FORMAT_SPACE;
+      else if (*p == '#') flags |= FORMAT_ALT;
+      else break;
+    }
+
+    size_t width = 0;
+    if (*p == '*') {
+      int w = va_arg(args, int);
+      if (w < 0) {
+        flags |= FORMAT_LEFT;
+        w = -w;
+      }
+      width = w;
+      p++;
+    } else {
+      while (*p >= '0' && *p <= '9') width = width * 10 + (*p++ - '0');
+    }
+
+    int precision = -1;
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        precision = va_arg(args, int);
+        if (precision < 0) precision = -1;
+        p++;
+      } else {
+        precision = 0;
+        while (*p >= '0' && *p <= '9') precision = precision * 10 + (*p++ - '0');
+      }
+    }
+
+    // Count how many 'l's (or their equivalents) were given, and note h and hh
+    int longs = 0;
+    int shorts = 0;
+    for (;; p++) {
+      if (*p == 'l') longs++;
+      else if (*p == 'z' || *p == 'j') longs = 2;
+      else if (*p == 'h') shorts++;
+      else break;
+    }
+
+    char conversion = *p;
+    if (conversion == '\0') break;
+    p++;
+
+    switch (conversion) {
+      case 'd':
+      case 'i': {
+        int64_t value = longs > 0 ? va_arg(args, int64_t) : va_arg(args, int);
+        if (shorts == 1) value = (int16_t) value;
+        else if (shorts >= 2) value = (int8_t) value;
+        // Negate as unsigned, so the most negative value works
+        uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+        const char* sign = value < 0 ? "-" : (flags & FORMAT_PLUS) ? "+" : (flags & FORMAT_SPACE) ? " " : "";
+        char* start = format_digits(digits_end, magnitude, 10, false);
+        format_integer(&out, start, digits_end - start, sign, flags, width, precision);
+        break;
+      }
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o': {
+        uint64_t value = longs > 0 ? va_arg(args, uint64_t) : va_arg(args, unsigned int);
+        if (shorts == 1) value = (uint16_t) value;
+        else if (shorts >= 2) value = (uint8_t) value;
+        int base = conversion == 'u' ? 10 : conversion == 'o' ? 8 : 16;
+        char* start = format_digits(digits_end, value, base, conversion == 'X');
+        const char* prefix = "";
+        if ((flags & FORMAT_ALT) && value != 0) {
+          prefix = conversion == 'x' ? "0x" : conversion == 'X' ? "0X" : conversion == 'o' ? "0" : "";
+        }
+        format_integer(&out, start, digits_end - start, prefix, flags, width, precision);
+        break;
+      }
+      case 'p': {
+        char* start = format_digits(digits_end, (uint64_t) va_arg(args, void*), 16, false);
+        format_integer(&out, start, digits_end - start, "0x", flags & FORMAT_LEFT, width, -1);
+        break;
+      }
+      case 'c': {
+        char c = va_arg(args, int);
+        size_t pad = width > 1 ? width - 1 : 0;
+        if (!(flags & FORMAT_LEFT)) format_fill(&out, ' ', pad);
+        format_put(&out, &c, 1);
+        if (flags & FORMAT_LEFT) format_fill(&out, ' ', pad);
+        break;
+      }
+      case 's': {
+        const char* str = va_arg(args, const char*);
+        if (str == NULL) str = "(null)";
+        // With a precision, the string need not be null-terminated
+        size_t len = 0;
+        while ((precision < 0 || len < (size_t) precision) && str[len] != '\0') len++;
+        size_t pad = width > len ? width - len : 0;
+        if (!(flags & FORMAT_LEFT)) format_fill(&out, ' ', pad);
+        format_put(&out, str, len);
+        if (flags & FORMAT_LEFT) format_fill(&out, ' ', pad);
+        break;
+      }
+      case '%':
+        format_put(&out, "%", 1);
+        break;
+      default:
+        format_put(&out, "<not supported>", 15);
+    }
+  }
+
+  if (size > 0) buf[out.len < size ? out.len : size - 1] = '\0';
+  return out.len;
+}
+
+/**
+* Formats a string into a buffer. See vsnprintf for the supported conversions.
+* \param buf The buffer to format into. At most size - 1 characters are written, then a null terminator.
+* \param size The size of the buffer.
+* \param format The string to format. Replaces format specifiers with next variadic argument.
+* \returns The length of the formatted string, which is size or more if it was cut off.
+*/
+int snprintf(char* buf, size_t size, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, size, format, args);
+  va_end(args);
+  return len;
+}
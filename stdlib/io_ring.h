@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// The number of entries in each ring. A power of two, so the free-running indices wrap cleanly.
+#define RING_ENTRIES 256
+
+// ring_setup flags. With RING_POLL, the kernel also drains the submission ring on every timer tick the
+// process spends in user mode, so queued writes and mmaps complete without ring_enter. Reads wait for
+// ring_enter, since they can block.
+#define RING_POLL 0x1
+
+// A queued operation. op is SYS_read, SYS_write or SYS_mmap, and args are the system call's arguments.
+typedef struct ring_sqe {
+  uint64_t op;
+  uint64_t args[6];
+  // Copied into the operation's completion untouched
+  uint64_t user_data;
+} ring_sqe_t;
+
+// The result of a finished operation
+typedef struct ring_cqe {
+  uint64_t user_data;
+  int64_t result;
+} ring_cqe_t;
+
+// The submission and completion rings, which ring_setup maps into the process. Indices run freely and
+// are taken modulo RING_ENTRIES. The process owns sq_tail and cq_head; the kernel owns sq_head and
+// cq_tail, and keeps its own copy of them, so the process can't make it skip entries.
+typedef struct ring {
+  volatile uint32_t sq_head;
+  volatile uint32_t sq_tail;
+  volatile uint32_t cq_head;
+  volatile uint32_t cq_tail;
+  ring_sqe_t sq[RING_ENTRIES];
+  ring_cqe_t cq[RING_ENTRIES];
+} ring_t;
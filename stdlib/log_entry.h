@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// How important a kernel log message is, most important first
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+// The most characters one log entry holds. Longer messages are split across entries.
+#define LOG_TEXT_SIZE 104
+
+// A kernel log message, as returned by the readlog system call
+typedef struct log_entry {
+  // Counts up from 0 with every entry logged, so a gap means entries were overwritten before being read
+  uint64_t seq;
+  // The time-stamp counter when the message was logged
+  uint64_t tsc;
+  uint8_t level;
+  // The CPU that logged the message
+  uint8_t cpu;
+  // The number of characters in text, which is not null-terminated
+  uint16_t len;
+  char text[LOG_TEXT_SIZE];
+} log_entry_t;
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <syscalls.h>
+
+#include "ring.h"
+
+/**
+* Maps a submission ring and a completion ring into the calling process. Each process can set up
+* its rings once; a forked child inherits a copy of its parent's.
+*
+* \param flags RING_POLL to have the kernel drain the submission ring on timer ticks, or 0.
+* \returns The rings, or NULL on error.
+*/
+ring_t* ring_setup(uint32_t flags) {
+  int64_t rc = syscall1(SYS_ring_setup, flags);
+  if (rc < 0) return NULL;
+  return (ring_t*) rc;
+}
+
+/**
+* Runs every queued operation in the kernel, unless the completion ring fills up first.
+*
+* \returns The number of operations run, or -1 on error.
+*/
+int64_t ring_enter() {
+  return syscall0(SYS_ring_enter);
+}
+
+/**
+* Queues an operation on the submission ring. It runs on the next ring_enter, or the next timer tick
+* with RING_POLL.
+*
+* \param ring The rings from ring_setup.
+* \param op The system call to run: SYS_read, SYS_write or SYS_mmap.
+* \param args The system call's six arguments.
+* \param user_data A value to hand back with the operation's completion.
+* \returns true if the operation was queued, or false if the submission ring is full.
+*/
+bool ring_queue(ring_t* ring, uint64_t op, const uint64_t args[6], uint64_t user_data) {
+  uint32_t tail = ring->sq_tail;
+  if (tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= RING_ENTRIES) return false;
+
+  ring_sqe_t* sqe = &ring->sq[tail % RING_ENTRIES];
+  sqe->op = op;
+  for (int i = 0; i < 6; i++) sqe->args[i] = args[i];
+  sqe->user_data = user_data;
+
+  // Publish the entry only once it is filled in
+  __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+* Queues a write. See write for the arguments.
+*
+* \param ring The rings from ring_setup.
+* \param user_data A value to hand back with the write's completion.
+* \returns true if the write was queued, or false if the submission ring is full.
+*/
+bool ring_write(ring_t* ring, int fd, const void* buf, size_t count, uint64_t user_data) {
+  uint64_t args[6] = {fd, (uint64_t) buf, count};
+  return ring_queue(ring, SYS_write, args, user_data);
+}
+
+/**
+* Queues a read. See read for the arguments.
+*
+* \param ring The rings from ring_setup.
+* \param user_data A value to hand back with the read's completion.
+* \returns true if the read was queued, or false if the submission ring is full.
+*/
+bool ring_read(ring_t* ring, int fd, void* buf, size_t count, uint64_t user_data) {
+  uint64_t args[6] = {fd, (uint64_t) buf, count};
+  return ring_queue(ring, SYS_read, args, user_data);
+}
+
+/**
+* Takes the oldest completion off the completion ring.
+*
+* \param ring The rings from ring_setup.
+* \param cqe Filled in with the completion.
+* \returns true if there was a completion, or false if the completion ring is empty.
+*/
+bool ring_complete(ring_t* ring, ring_cqe_t* cqe) {
+  uint32_t head = ring->cq_head;
+  if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+  *cqe = ring->cq[head % RING_ENTRIES];
+  // Hand the slot back only once the completion is copied out
+  __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
@@ -3,192 +3,293 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdio.h>
 
-/** Prints a character on the terminal.
-* \param c The character to print.
+// The standard streams and their buffers. stderr is unbuffered, so it needs none.
+static char stdin_buf[BUFSIZ];
+static char stdout_buf[BUFSIZ];
+static FILE stdin_file = {.fd = 0, .mode = _IOFBF, .buf = stdin_buf, .size = BUFSIZ};
+static FILE stdout_file = {.fd = 1, .mode = _IOLBF, .buf = stdout_buf, .size = BUFSIZ};
+static FILE stderr_file = {.fd = 2, .mode = _IONBF, .buf = NULL, .size = 0};
+FILE* stdin = &stdin_file;
+FILE* stdout = &stdout_file;
+FILE* stderr = &stderr_file;
+
+/**
+* Changes how a stream is buffered. Must be called before the stream is used.
+* \param stream The stream.
+* \param buf A buffer for the stream to use, or NULL to keep its current one.
+* \param mode _IOFBF, _IOLBF or _IONBF.
+* \param size The size of buf.
+* \returns 0 on success, or -1 if the mode is unknown.
 */
-void print_c(char c) {
-  write(1, &c, 1);
+int setvbuf(FILE* stream, char* buf, int mode, size_t size) {
+  if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) return -1;
+  stream->mode = mode;
+  if (buf != NULL) {
+    stream->buf = buf;
+    stream->size = size;
+  }
+  // A stream without a buffer can only be unbuffered
+  if (stream->buf == NULL || stream->size == 0) stream->mode = _IONBF;
+  return 0;
 }
 
-/** Prints a string on the terminal.
-* \param str The string to print.
+/**
+* Writes characters to a stream's file descriptor, bypassing its buffer.
+* \param stream The stream.
+* \param buf The characters to write.
+* \param len The number of characters.
+* \returns true on success, or false if the write failed.
 */
-void print_s(const char* str) {
-  int length = stringlen(str);
-  write(1, str, length);
+static bool stream_write(FILE* stream, const char* buf, size_t len) {
+  while (len > 0) {
+    int64_t written = write(stream->fd, buf, len);
+    if (written <= 0) {
+      stream->error = true;
+      return false;
+    }
+    buf += written;
+    len -= written;
+  }
+  return true;
 }
 
-/*inspiration to use number % base in print_d and print_x
-https://programmerall.com/article/50851418599/
+/**
+* Writes a stream's buffered output to its file descriptor.
+* \param stream The stream, or NULL to flush every output stream.
+* \returns 0 on success, or EOF if the write failed.
 */
-/** Prints an unsigned integer on the terminal.
-* \param value The unsigned integer to print.
+int fflush(FILE* stream) {
+  if (stream == NULL) return fflush(stdout) | fflush(stderr);
+  // Input streams have nothing to flush
+  if (stream == stdin) return 0;
+  size_t pending = stream->pos;
+  stream->pos = 0;
+  return stream_write(stream, stream->buf, pending) ? 0 : EOF;
+}
+
+/**
+* Adds characters to a stream's buffer, writing it out when it fills or, for a line buffered stream,
+* when a newline is added. Output too big for the buffer is written straight through.
+* \param stream The stream.
+* \param buf The characters to add.
+* \param len The number of characters.
+* \returns true on success, or false if a write failed.
 */
-void print_d(uint64_t value){
-  char arr[20];
-  int counter = 0;
-  for (size_t i = 19; i >= 0; i--) {
-    int currentPlace = value%10;
-    arr[i] = currentPlace;
-    value = value/10;
-    if (value == 0){
-      counter = i;
-      break;
-    }
+static bool stream_put(FILE* stream, const char* buf, size_t len) {
+  if (stream->mode == _IONBF) return stream_write(stream, buf, len);
+
+  if (len > stream->size - stream->pos) {
+    if (fflush(stream) != 0) return false;
+    if (len >= stream->size) return stream_write(stream, buf, len);
   }
+  memcpy(&stream->buf[stream->pos], buf, len);
+  stream->pos += len;
 
-  for(size_t i = counter; i < 20; i++) {
-      if (arr[i] >= 0 && arr[i] <= 9) {
-      print_c(48 + arr[i]);
+  if (stream->mode == _IOLBF) {
+    for (size_t i = 0; i < len; i++) {
+      if (buf[i] == '\n') return fflush(stream) == 0;
     }
   }
+  return true;
+}
+
+/**
+* Writes a character to a stream.
+* \param c The character to write.
+* \param stream The stream.
+* \returns The character written, or EOF on error.
+*/
+int fputc(int c, FILE* stream) {
+  char ch = c;
+  return stream_put(stream, &ch, 1) ? (unsigned char) ch : EOF;
 }
 
-/** Prints an unsigned integer in hexadecimal on the terminal.
-* \param value The unsigned integer to print.
+/**
+* Writes a string to a stream, without a trailing newline.
+* \param s The string to write.
+* \param stream The stream.
+* \returns A non-negative number on success, or EOF on error.
 */
-void print_x(uint64_t value){
-  char arr[20];
-  int counter = 0;
-  for (size_t i = 19; i >= 0; i--) {
-    int currentPlace = value%16;
-    arr[i] = currentPlace;
-    value = value/16;
-    if (value == 0){
-      counter = i;
-      break;
+int fputs(const char* s, FILE* stream) {
+  return stream_put(stream, s, stringlen(s)) ? 0 : EOF;
+}
+
+/**
+* Writes items to a stream.
+* \param ptr The items to write.
+* \param size The size of each item.
+* \param count The number of items.
+* \param stream The stream.
+* \returns The number of items written, which is less than count on error.
+*/
+size_t fwrite(const void* ptr, size_t size, size_t count, FILE* stream) {
+  if (size == 0 || count == 0) return 0;
+  return stream_put(stream, (const char*) ptr, size * count) ? count : 0;
+}
+
+/**
+* Refills an input stream's buffer with one read. Reading from stdin flushes stdout first, so a prompt
+* written without a newline shows up before the program waits for input.
+* \param stream The stream, which must have nothing left in its buffer.
+* \returns true if anything was read, or false at the end of input or on error.
+*/
+static bool stream_fill(FILE* stream) {
+  if (stream->eof || stream->error) return false;
+  if (stream == stdin) fflush(stdout);
+
+  int64_t count = read(stream->fd, stream->buf, stream->size);
+  if (count <= 0) {
+    if (count == 0) stream->eof = true;
+    else stream->error = true;
+    return false;
+  }
+  stream->pos = 0;
+  stream->len = count;
+  return true;
+}
+
+/**
+* Reads a character from a stream. Reading from stdin flushes stdout first, so prompts are shown.
+* \param stream The stream.
+* \returns The character, or EOF at the end of input or on error.
+*/
+int fgetc(FILE* stream) {
+  if (stream->mode == _IONBF) {
+    if (stream == stdin) fflush(stdout);
+    char c;
+    return read(stream->fd, &c, 1) == 1 ? (unsigned char) c : EOF;
+  }
+  if (stream->pos == stream->len && !stream_fill(stream)) return EOF;
+  return (unsigned char) stream->buf[stream->pos++];
+}
+
+/**
+* Reads items from a stream.
+* \param ptr Where to store the items.
+* \param size The size of each item.
+* \param count The number of items.
+* \param stream The stream.
+* \returns The number of items read, which is less than count at the end of input or on error.
+*/
+size_t fread(void* ptr, size_t size, size_t count, FILE* stream) {
+  if (size == 0 || count == 0) return 0;
+  char* dest = (char*) ptr;
+  size_t want = size * count;
+  size_t done = 0;
+  while (done < want) {
+    if (stream->mode == _IONBF) {
+      int c = fgetc(stream);
+      if (c == EOF) break;
+      dest[done++] = c;
+      continue;
     }
+    // Copy whatever is buffered, then refill
+    if (stream->pos == stream->len && !stream_fill(stream)) break;
+    size_t chunk = stream->len - stream->pos;
+    if (chunk > want - done) chunk = want - done;
+    memcpy(&dest[done], &stream->buf[stream->pos], chunk);
+    stream->pos += chunk;
+    done += chunk;
   }
+  return done / size;
+}
 
-  for(size_t i = counter; i < 20; i++) {
-      if (arr[i] >= 0 && arr[i] <= 9) {
-      print_c(48 + arr[i]);
-    } else {
-      print_c(87 + arr[i]);
+/**
+* Writes a formatted string to a stream. See vsnprintf for the supported conversions.
+* \param stream The stream.
+* \param format The string to format.
+* \param args The values to format.
+* \returns The number of characters written.
+*/
+int vfprintf(FILE* stream, const char* format, va_list args) {
+  char buf[PRINTF_BUFFER_SIZE];
+  va_list retry;
+  va_copy(retry, args);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+
+  if (len < sizeof(buf)) {
+    stream_put(stream, buf, len);
+  } else {
+    // Too long for the stack, so format it again into a buffer that fits
+    char* big = malloc(len + 1);
+    if (big != NULL) {
+      vsnprintf(big, len + 1, format, retry);
+      stream_put(stream, big, len);
+      free(big);
     }
   }
+  va_end(retry);
+  return len;
 }
 
-/** Prints a pointer on the terminal.
-* \param value The pointer to print.
+/**
+* Writes a formatted string to a stream. See vsnprintf for the supported conversions.
+* \param stream The stream.
+* \param format The string to format. Replaces format specifiers with next variadic argument.
+* \returns The number of characters written.
 */
-void print_p(void* ptr) {
-  uint64_t value = (uint64_t) ptr;
-  print_s("0x");
-  print_x(value);
+int fprintf(FILE* stream, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int len = vfprintf(stream, format, args);
+  va_end(args);
+  return len;
 }
 
-/** Prints a formatted string on the terminal. Supported format specifiers include:
-* %c: char : character
-* %d: uint64_t : unsigned 64-bit integer
-* %s: const char* : string
-* %x: uint64_t : unsigned 64-bit integer in hexadecimal
-* %p void* : pointer
-* Instances of these in format are replaced by the next variadic argument.
+/** Prints a formatted string to stdout. See vsnprintf for the supported conversions.
 * \param format the string to format. Replaces format specifiers with next variadic argument.
+* \returns The number of characters printed.
 */
-void printf(const char* format, ...) {
-  // Start processing variadic arguments
+int printf(const char* format, ...) {
   va_list args;
   va_start(args, format);
-
-  // Loop until we reach the end of the format string
-  size_t index = 0;
-  while (format[index] != '\0') {
-    // Is the current charater a '%'?
-    if (format[index] == '%') {
-      // Yes, print the argument
-      index++;
-      switch(format[index]) {
-        case '%':
-          print_c('%');
-          break;
-        case 'c':
-          print_c(va_arg(args, int));
-          break;
-        case 's':
-          print_s(va_arg(args, char*));
-          break;
-        case 'd':
-          print_d(va_arg(args, uint64_t));
-          break;
-        case 'x':
-          print_x(va_arg(args, int64_t));
-          break;
-        case 'p':
-          print_p(va_arg(args, void*));
-          break;
-        default:
-          print_s("<not supported>");
-      }
-    } else {
-      // No, just a normal character. Print it.
-      print_c(format[index]);
-    }
-    index++;
-  }
-
-  // Finish handling variadic arguments
+  int len = vfprintf(stdout, format, args);
   va_end(args);
+  return len;
 }
 
 /**
-* Obtains a line from standard input. Stops reading characters when a newline character is read.
+* Obtains a line from stdin. Stops reading characters when a newline character is read.
 * If *lineptr is NULL or *n is 0, memory is allocated for the buffer and *n is set appropriately.
 * If *lineptr was not large enough to hold the line, it is automatically resized. *lineptr should
 * be freed when it is no longer used. This version does not include a parameter to specify the input
 * file.
-* 
+*
 * \param lineptr Pointer to a character buffer that will hold the result.
 * \param n A pointer to the size of the lineptr buffer.
-* \returns The number of characters read, including the newline character.
+* \returns The number of characters read, including the newline character, or -1 if input ended first.
 */
 int64_t getline(char** lineptr, size_t* n) {
   if (*lineptr == NULL || *n == 0) {
     *lineptr = malloc(sizeof(char) * 120);
     *n = 120;
-  } /*else if (*lineptr == NULL) {
-    *lineptr = malloc(sizeof(char) * *n);
-  } */
-  // Initialize variables for reading.
-  int64_t num_read = -1;
-  char current;
-  char* cursor = *lineptr;
-  // Loop until a newline is read.
+  }
+  int64_t num_read = 0;
   while (1) {
-    // Read characters one at a time.
-    read(0, &current, 1);
-    //write(1, &current, 1);
-    num_read++;
-    // If the size of *lineptr is equal to or less than 
-    // the number of characters read, double the size of the buffer
-    // and copy the characters that have been read so far into the new buffer.
-    if (*n <= num_read) {
+    int c = fgetc(stdin);
+    if (c == EOF) break;
+    // Leave room for the null terminator, doubling the buffer and copying the line so far when it's full
+    if (num_read + 1 >= *n) {
       *n *= 2;
       char* temp = *lineptr;
       *lineptr = malloc(sizeof(char) * *n);
       memcpy(*lineptr, temp, num_read);
       free(temp);
-      cursor = *lineptr + num_read;
-    }
-    *cursor = current;
-    cursor++;
-    // If the line has reached its end, add a null terminator after the newline 
-    // and exit the loop.
-    if (current == '\n') {
-      cursor[1] = '\0';
-      break;
     }
+    (*lineptr)[num_read++] = c;
+    if (c == '\n') break;
   }
-  return (num_read == 0 ? num_read : num_read + 1);
+  (*lineptr)[num_read] = '\0';
+  return num_read == 0 ? -1 : num_read;
 }
 
 /**
-* Writes an error message to standard error.
-* 
+* Writes an error message to stderr.
+*
 * \param s A string to print.
 */
 void perror(const char *s) {
-  write(2, s, stringlen(s));
-}
\ No newline at end of file
+  fputs(s, stderr);
+}
@@ -1,18 +1,155 @@
 #pragma once
 
-/** Prints a formatted string on the terminal. Supported format specifiers include:
-* %c: char : character
-* %d: uint64_t : unsigned 64-bit integer
-* %s: const char* : string
-* %x: uint64_t : unsigned 64-bit integer in hexadecimal
-* %p void* : pointer
-* Instances of these in format are replaced by the next variadic argument.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+// The longest output printf formats on the stack; longer output is formatted into allocated memory
+#define PRINTF_BUFFER_SIZE 256
+
+// The size of each standard stream's buffer
+#define BUFSIZ 1024
+
+// Returned by fgetc at the end of input or on an error
+#define EOF (-1)
+
+// Buffering modes for setvbuf. A fully buffered stream writes when its buffer fills, a line buffered one
+// also writes at each newline, and an unbuffered one writes every call straight through.
+#define _IOFBF 0
+#define _IOLBF 1
+#define _IONBF 2
+
+// A buffered stream on a file descriptor. A stream is only read or only written, so one buffer serves
+// both: pos is how far output has been filled, or how far input has been consumed of the len bytes read.
+typedef struct file {
+  int fd;
+  int mode;
+  char* buf;
+  size_t size;
+  size_t pos;
+  size_t len;
+  bool eof;
+  bool error;
+} FILE;
+
+// Standard input is fully buffered and refilled a line at a time, standard output is line buffered, and
+// standard error is unbuffered
+extern FILE* stdin;
+extern FILE* stdout;
+extern FILE* stderr;
+
+/**
+* Changes how a stream is buffered. Must be called before the stream is used.
+* \param stream The stream.
+* \param buf A buffer for the stream to use, or NULL to keep its current one.
+* \param mode _IOFBF, _IOLBF or _IONBF.
+* \param size The size of buf.
+* \returns 0 on success, or -1 if the mode is unknown.
+*/
+int setvbuf(FILE* stream, char* buf, int mode, size_t size);
+
+/**
+* Writes a stream's buffered output to its file descriptor.
+* \param stream The stream, or NULL to flush every output stream.
+* \returns 0 on success, or EOF if the write failed.
+*/
+int fflush(FILE* stream);
+
+/**
+* Writes a character to a stream.
+* \param c The character to write.
+* \param stream The stream.
+* \returns The character written, or EOF on error.
+*/
+int fputc(int c, FILE* stream);
+
+/**
+* Writes a string to a stream, without a trailing newline.
+* \param s The string to write.
+* \param stream The stream.
+* \returns A non-negative number on success, or EOF on error.
+*/
+int fputs(const char* s, FILE* stream);
+
+/**
+* Writes items to a stream.
+* \param ptr The items to write.
+* \param size The size of each item.
+* \param count The number of items.
+* \param stream The stream.
+* \returns The number of items written, which is less than count on error.
+*/
+size_t fwrite(const void* ptr, size_t size, size_t count, FILE* stream);
+
+/**
+* Reads a character from a stream. Reading from stdin flushes stdout first, so prompts are shown.
+* \param stream The stream.
+* \returns The character, or EOF at the end of input or on error.
+*/
+int fgetc(FILE* stream);
+
+/**
+* Reads items from a stream.
+* \param ptr Where to store the items.
+* \param size The size of each item.
+* \param count The number of items.
+* \param stream The stream.
+* \returns The number of items read, which is less than count at the end of input or on error.
+*/
+size_t fread(void* ptr, size_t size, size_t count, FILE* stream);
+
+/**
+* Writes a formatted string to a stream. See vsnprintf for the supported conversions.
+* \param stream The stream.
+* \param format The string to format.
+* \param args The values to format.
+* \returns The number of characters written.
+*/
+int vfprintf(FILE* stream, const char* format, va_list args);
+
+/**
+* Writes a formatted string to a stream. See vsnprintf for the supported conversions.
+* \param stream The stream.
+* \param format The string to format. Replaces format specifiers with next variadic argument.
+* \returns The number of characters written.
+*/
+int fprintf(FILE* stream, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+* Formats a string into a buffer. This is the engine behind printf, snprintf and kprintf. Conversions
+* take the form %[flags][width][.precision][length]conversion, where:
+* flags: '-' left-justifies, '0' pads numbers with zeros, '+' and ' ' put a sign before positive numbers,
+*        '#' puts 0x before nonzero hexadecimal numbers and 0 before octal ones
+* width, precision: a number, or '*' to take it from the next argument
+* length: hh, h, l, ll, z or j for integer arguments of other sizes than int
+* conversion: d and i (signed), u, x, X and o (unsigned), c, s, p, or % for a literal '%'
+* Unknown conversions print "<not supported>".
+* \param buf The buffer to format into. At most size - 1 characters are written, then a null terminator.
+* \param size The size of the buffer. May be 0, to only measure the result.
+* \param format The string to format.
+* \param args The values to format.
+* \returns The length of the formatted string, which is size or more if it was cut off.
+*/
+int vsnprintf(char* buf, size_t size, const char* format, va_list args);
+
+/**
+* Formats a string into a buffer. See vsnprintf for the supported conversions.
+* \param buf The buffer to format into. At most size - 1 characters are written, then a null terminator.
+* \param size The size of the buffer.
+* \param format The string to format. Replaces format specifiers with next variadic argument.
+* \returns The length of the formatted string, which is size or more if it was cut off.
+*/
+int snprintf(char* buf, size_t size, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+/** Prints a formatted string to stdout. See vsnprintf for the supported conversions.
 * \param format the string to format. Replaces format specifiers with next variadic argument.
+* \returns The number of characters printed.
 */
-int printf(const char* format, ...);
+int printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
 
 /**
-* Obtains a line from standard input. Stops reading characters when a newline character is read.
+* Obtains a line from stdin. Stops reading characters when a newline character is read.
 * If *lineptr is NULL or *n is 0, memory is allocated for the buffer and *n is set appropriately.
 * If *lineptr was not large enough to hold the line, it is automatically resized. *lineptr should
 * be freed when it is no longer used.
@@ -24,7 +161,7 @@ int printf(const char* format, ...);
 int64_t getline(char** lineptr, size_t* n);
 
 /**
-* Writes an error message to standard error.
+* Writes an error message to stderr.
 * 
 * \param s A string to print.
 */
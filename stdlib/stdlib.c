@@ -5,20 +5,19 @@
 #include <stdio.h>
 #include <unistd.h>
 
-extern int64_t syscall(uint64_t nr, ...);
-
 /** Maps a new page into the virtual address space of the calling process.
 * If addr is NULL, mmap chooses a page-aligned location to place the mapping.
 * \param addr The desired address at which the mapping should begin.
 * \param length The desired length of the mapping, in bytes. Rounded up to the next page internally.
 * \param prot Permissions to associate with the mapping. Defined in stdlib.h.
-* \param flags Flags to associate with the mapping. Disregarded in this simple implementation.
+* \param flags Flags to associate with the mapping. MAP_HUGETLB backs the mapping with 2 MiB pages, or 1 GiB pages
+*              if MAP_HUGE_1GB is also set. Other flags are disregarded in this simple implementation.
 * \param fd Contents of the mapping to add. Disregarded in this simple implementation.
 * \param offset Offset into the file at which the mapping should begin. Disregarded in this simple implementation.
-* \returns A pointer to the start of the mapped region.
+* \returns A pointer to the start of the mapped region, or -1 if the region is not in user memory or cannot be reserved.
 */
 void* mmap(void *addr, size_t length, int prot, int flags, int fd, uint16_t offset) {
-  return (void*) syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+  return (void*) syscall6(SYS_mmap, (uint64_t) addr, length, prot, flags, fd, offset);
 }
 
 // Round a value x up to the next multiple of y
@@ -87,12 +86,13 @@ int atoi(const char *nptr) {
   return result;
 }
 
-/** Terminates the calling process by loading the kernel's init program. Should be called by all processes
-* that terminate using this kernel.
+/** Terminates the calling process and resumes the process that started it. Should be called by all processes
+* that terminate using this kernel. Buffered output on stdout and stderr is written first.
 * \param ex The error code that the process exits with.
 * \returns nothing in normal execution, or -1 if the internal system call failed.
 */
 int64_t exit(uint64_t ex) {
-  syscall(SYS_exit, ex);
+  fflush(NULL);
+  syscall1(SYS_exit, ex);
   return -1;
 }
@@ -1,12 +1,10 @@
 #pragma once
 
 #include <stddef.h>
+#include <syscalls.h>
 
 #define PAGE_SIZE 0x1000
 
-#define SYS_mmap 2
-#define SYS_exit 4
-
 #define PROT_NONE 0x0
 #define PROT_EXEC 0x1
 #define PROT_WRITE 0x2
@@ -14,16 +12,19 @@
 
 #define MAP_ANONYMOUS 0x1
 #define MAP_PRIVATE 0x2
+#define MAP_HUGETLB 0x4
+#define MAP_HUGE_1GB 0x8
 
 /** Maps a new page into the virtual address space of the calling process.
 * If addr is NULL, mmap chooses a page-aligned location to place the mapping.
 * \param addr The desired address at which the mapping should begin.
 * \param length The desired length of the mapping, in bytes. Rounded up to the next page internally.
 * \param prot Permissions to associate with the mapping. Defined above.
-* \param flags Flags to associate with the mapping. Disregarded in this simple implementation.
+* \param flags Flags to associate with the mapping. MAP_HUGETLB backs the mapping with 2 MiB pages, or 1 GiB pages
+*              if MAP_HUGE_1GB is also set. Other flags are disregarded in this simple implementation.
 * \param fd Contents of the mapping to add. Disregarded in this simple implementation.
 * \param offset Offset into the file at which the mapping should begin. Disregarded in this simple implementation.
-* \returns A pointer to the start of the mapped region.
+* \returns A pointer to the start of the mapped region, or -1 if the region is not in user memory or cannot be reserved.
 */
 void* mmap(void* addr, size_t length, int prot, int flags, int fd, uint16_t offset);
 
@@ -45,8 +46,8 @@ void free(void* p);
  */
 int atoi(const char* nptr);
 
-/** Terminates the calling process by loading the kernel's init program. Should be called by all processes
-* that terminate using this kernel.
+/** Terminates the calling process and resumes the process that started it. Should be called by all processes
+* that terminate using this kernel. Buffered output on stdout and stderr is written first.
 * \param ex The error code that the process exits with.
 * \returns nothing in normal execution, or -1 if the internal system call failed.
 */
@@ -1,6 +1,7 @@
 .global syscall
 
-# This function is called to issue a system call
+# This function issues a system call with int $0x80. The stubs in unistd.h use the faster syscall
+# instruction instead; this path is kept for compatibility.
 # Arguments are:
 #  syscall number (in %rdi)
 #  syscall arg0 (in %rsi)
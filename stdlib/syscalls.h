@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// The system calls, shared by the kernel and the C library. Each entry is X(number, name); the kernel
+// handles system call name with sys_name. Numbers must stay dense, since they index tables.
+#define SYSCALL_LIST(X) \
+  X(0, read) \
+  X(1, write) \
+  X(2, mmap) \
+  X(3, exec) \
+  X(4, exit) \
+  X(5, fork) \
+  X(6, stats) \
+  X(7, ring_setup) \
+  X(8, ring_enter) \
+  X(9, readlog) \
+  X(10, ioctl)
+
+#define SYSCALL_NUMBER(nr, name) SYS_##name = nr,
+enum syscall_number {
+  SYSCALL_LIST(SYSCALL_NUMBER)
+  NUM_SYSCALLS
+};
+#undef SYSCALL_NUMBER
+
+// The number of buckets in a system call's latency histogram. Bucket i counts the calls that took
+// between 2^i and 2^(i+1) cycles; the last bucket also counts everything slower.
+#define SYSCALL_HISTOGRAM_BUCKETS 32
+
+// How often a system call has been made and how long it took, as reported by the stats system call
+typedef struct syscall_stats {
+  uint64_t count;
+  // The total number of cycles spent in the kernel handling the call
+  uint64_t cycles;
+  uint64_t histogram[SYSCALL_HISTOGRAM_BUCKETS];
+} syscall_stats_t;
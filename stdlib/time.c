@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "time.h"
+
+/**
+* Gets the time since boot from the kernel's time page, without a system call.
+* \returns The number of nanoseconds since boot.
+*/
+uint64_t clock_ns() {
+  const time_page_t* page = (const time_page_t*) TIME_PAGE_ADDRESS;
+  uint32_t sequence;
+  uint64_t ns;
+  do {
+    // Wait out an update in progress, then read everything and make sure no update started meanwhile
+    while ((sequence = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE)) & 1) __asm__ volatile("pause");
+    // The lfence keeps rdtsc from running before the loads above, which could put it before tsc_base
+    __asm__ volatile("lfence" ::: "memory");
+    uint64_t delta = rdtsc() - page->tsc_base;
+    ns = page->ns_base + (uint64_t) (((unsigned __int128) delta * page->mult) >> page->shift);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) != sequence);
+  return ns;
+}
+
+/**
+* Reads a clock, without a system call.
+* \param clock The clock to read. Must be CLOCK_MONOTONIC.
+* \param ts Filled in with the time.
+* \returns 0 on success, or -1 if the clock is not supported.
+*/
+int clock_gettime(clockid_t clock, struct timespec* ts) {
+  if (clock != CLOCK_MONOTONIC) return -1;
+  uint64_t ns = clock_ns();
+  ts->tv_sec = ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+  return 0;
+}
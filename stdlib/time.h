@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "time_page.h"
+
+// The only clock: time since boot, which never goes backwards
+#define CLOCK_MONOTONIC 1
+
+typedef int clockid_t;
+
+struct timespec {
+  int64_t tv_sec;
+  int64_t tv_nsec;
+};
+
+/**
+* Reads the time-stamp counter.
+* \returns The number of cycles since the CPU was reset.
+*/
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+  return ((uint64_t) high << 32) | low;
+}
+
+/**
+* Gets the time since boot from the kernel's time page, without a system call.
+* \returns The number of nanoseconds since boot.
+*/
+uint64_t clock_ns();
+
+/**
+* Reads a clock, without a system call.
+* \param clock The clock to read. Must be CLOCK_MONOTONIC.
+* \param ts Filled in with the time.
+* \returns 0 on success, or -1 if the clock is not supported.
+*/
+int clock_gettime(clockid_t clock, struct timespec* ts);
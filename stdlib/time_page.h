@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Where the kernel maps the time page, read-only, in every process
+#define TIME_PAGE_ADDRESS 0x6FFFFFFF000
+
+// Data for turning time-stamp counter readings into time, which the kernel updates on every timer tick.
+// Nanoseconds since boot are ns_base + ((tsc - tsc_base) * mult >> shift).
+typedef struct time_page {
+  // Odd while the kernel is updating the page. A read is only valid if this was even and unchanged
+  // throughout.
+  volatile uint32_t sequence;
+  uint32_t shift;
+  uint64_t mult;
+  uint64_t tsc_base;
+  uint64_t ns_base;
+} time_page_t;
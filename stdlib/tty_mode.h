@@ -0,0 +1,20 @@
+#pragma once
+
+// Requests for the ioctl system call on the terminal
+#define TTY_GET_MODE 1
+#define TTY_SET_MODE 2
+
+// Terminal mode flags. In canonical mode, input is collected into lines that can be edited with the
+// erase and kill characters, and a read completes once a whole line is ready. Without it (raw mode),
+// every character is passed through as soon as it arrives. With TTY_ECHO, input is shown on the console.
+#define TTY_CANONICAL 0x1
+#define TTY_ECHO 0x2
+#define TTY_MODE_DEFAULT (TTY_CANONICAL | TTY_ECHO)
+
+// Characters with special meanings in canonical mode: erase deletes the last character of the line, and
+// kill (Ctrl-U) deletes the whole line
+#define TTY_ERASE '\b'
+#define TTY_KILL 0x15
+
+// The longest line canonical mode collects. A line that reaches this length is completed as is.
+#define TTY_LINE_MAX 256
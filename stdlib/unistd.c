@@ -1,12 +1,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
-
-#define SYS_read 0
-#define SYS_write 1
-#define SYS_exec 3
-
-extern int64_t syscall(uint64_t nr, ...);
+#include <unistd.h>
+#include <syscalls.h>
 
 /**
 * Reads characters from a specified file and places them in a buffer.
@@ -14,11 +10,11 @@ extern int64_t syscall(uint64_t nr, ...);
 * \param fd The file descriptor to read from. Should be 0.
 * \param buf A pointer to store read characters in.
 * \param count The number of character to read.
-* \returns The number of characters read.
+* \returns The number of characters read, or -1 if fd is invalid or buf is not in user memory.
 */
 int64_t read(int fd, void *buf, size_t count) {
   if (count == 0) return 0;
-  return syscall(SYS_read, fd, buf, count);
+  return syscall3(SYS_read, fd, (uint64_t) buf, count);
 }
 
 /**
@@ -27,20 +23,81 @@ int64_t read(int fd, void *buf, size_t count) {
 * \param fd The file descriptor to read from. Should be 1 or 2.
 * \param buf The buffer to write from.
 * \param count The number of character to write.
-* \returns The number of characters written.
+* \returns The number of characters written, or -1 if fd is invalid or buf is not in user memory.
 */
 int64_t write(int fd, const void *buf, size_t count) {
   if (count == 0) return 0;
-  return syscall(SYS_write, fd, buf, count);
+  return syscall3(SYS_write, fd, (uint64_t) buf, count);
 }
 
 /**
-* Loads a process.
+* Runs a program in a new process and waits for it to exit.
 * 
-* \param name The name of the process to load.
-* \returns -1, since if this point is reached the process was not loaded.
+* \param name The name of the program to run.
+* \returns The low 8 bits of the program's exit code, or -1 if the program was not found, -2 if it was
+* not executable, or -3 if memory ran out.
 */
 int64_t exec(char* name) {
-  syscall(SYS_exec, name);
-  return -1;
+  return syscall1(SYS_exec, (uint64_t) name);
+}
+
+/**
+* Creates a copy of the calling process. The copy shares the caller's memory until either one writes to it.
+* 
+* \returns The child's process ID in the parent, 0 in the child, or -1 on error.
+*/
+int64_t fork() {
+  return syscall0(SYS_fork);
+}
+
+/**
+* Reads how often each system call has been made and how long it took.
+*
+* \param stats An array to fill in, indexed by system call number.
+* \param count The number of entries stats has room for.
+* \returns The number of entries filled in, or -1 if stats is not a valid user address.
+*/
+int64_t syscall_stats(syscall_stats_t* stats, size_t count) {
+  return syscall3(SYS_stats, (uint64_t) stats, count, 0);
+}
+
+/**
+* Reads the newest messages in the kernel log, oldest first.
+*
+* \param entries An array to fill in.
+* \param count The number of entries the array has room for.
+* \returns The number of entries filled in, or -1 if entries is not a valid user address.
+*/
+int64_t readlog(log_entry_t* entries, size_t count) {
+  return syscall3(SYS_readlog, (uint64_t) entries, count, 0);
+}
+
+/**
+* Reads or changes the terminal's mode. TTY_SET_MODE with TTY_ECHO alone switches to raw mode, where reads
+* return each key as it arrives; TTY_MODE_DEFAULT switches back to reading whole lines.
+*
+* \param fd The terminal's file descriptor, 0, 1 or 2.
+* \param request TTY_GET_MODE or TTY_SET_MODE, from tty_mode.h.
+* \param arg The new mode for TTY_SET_MODE, made of TTY_CANONICAL and TTY_ECHO.
+* \returns The mode for TTY_GET_MODE, 0 for TTY_SET_MODE, or -1 on error.
+*/
+int64_t ioctl(int fd, uint64_t request, uint64_t arg) {
+  return syscall3(SYS_ioctl, fd, request, arg);
+}
+
+// The name of each system call, indexed by number
+#define SYSCALL_NAME(nr, name) [nr] = #name,
+static const char* syscall_names[NUM_SYSCALLS] = {
+  SYSCALL_LIST(SYSCALL_NAME)
+};
+#undef SYSCALL_NAME
+
+/**
+* Gets the name of a system call.
+*
+* \param nr The system call number.
+* \returns The name, or NULL if there is no system call with that number.
+*/
+const char* syscall_name(uint64_t nr) {
+  return nr < NUM_SYSCALLS ? syscall_names[nr] : NULL;
 }
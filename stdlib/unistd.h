@@ -2,14 +2,102 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <syscalls.h>
+#include <log_entry.h>
+#include <tty_mode.h>
 
 /**
-* Reads characters from a specified file and places them in a buffer.
+* Issues a system call with the int $0x80 instruction. Kept for compatibility; the syscallN stubs below
+* use the much cheaper syscall instruction.
+*
+* \param nr The system call number, followed by up to six arguments.
+* \returns The value returned by the system call.
+*/
+int64_t syscall(uint64_t nr, ...);
+
+// The syscall stubs below pass the system call number in %rdi and the arguments in %rsi, %rdx, %r10, %r8,
+// %r9 and %rax. The syscall instruction overwrites %rcx and %r11, and the kernel doesn't preserve the
+// other argument registers, so they are all marked as clobbered.
+
+/**
+* Issues a system call with no arguments.
+* \param nr The system call number.
+* \returns The value returned by the system call.
+*/
+static inline int64_t syscall0(uint64_t nr) {
+  int64_t rc;
+  __asm__ volatile("syscall"
+                   : "=a"(rc), "+D"(nr)
+                   :
+                   : "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "memory");
+  return rc;
+}
+
+/**
+* Issues a system call with one argument.
+* \param nr The system call number.
+* \param arg0 The first argument.
+* \returns The value returned by the system call.
+*/
+static inline int64_t syscall1(uint64_t nr, uint64_t arg0) {
+  int64_t rc;
+  __asm__ volatile("syscall"
+                   : "=a"(rc), "+D"(nr), "+S"(arg0)
+                   :
+                   : "rdx", "rcx", "r8", "r9", "r10", "r11", "memory");
+  return rc;
+}
+
+/**
+* Issues a system call with three arguments.
+* \param nr The system call number.
+* \param arg0 The first argument.
+* \param arg1 The second argument.
+* \param arg2 The third argument.
+* \returns The value returned by the system call.
+*/
+static inline int64_t syscall3(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2) {
+  int64_t rc;
+  register uint64_t r10 __asm__("r10") = arg2;
+  __asm__ volatile("syscall"
+                   : "=a"(rc), "+D"(nr), "+S"(arg0), "+d"(arg1), "+r"(r10)
+                   :
+                   : "rcx", "r8", "r9", "r11", "memory");
+  return rc;
+}
+
+/**
+* Issues a system call with six arguments.
+* \param nr The system call number.
+* \param arg0 The first argument.
+* \param arg1 The second argument.
+* \param arg2 The third argument.
+* \param arg3 The fourth argument.
+* \param arg4 The fifth argument.
+* \param arg5 The sixth argument.
+* \returns The value returned by the system call.
+*/
+static inline int64_t syscall6(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                               uint64_t arg4, uint64_t arg5) {
+  int64_t rc = arg5;
+  register uint64_t r10 __asm__("r10") = arg2;
+  register uint64_t r8 __asm__("r8") = arg3;
+  register uint64_t r9 __asm__("r9") = arg4;
+  __asm__ volatile("syscall"
+                   : "+a"(rc), "+D"(nr), "+S"(arg0), "+d"(arg1), "+r"(r10), "+r"(r8), "+r"(r9)
+                   :
+                   : "rcx", "r11", "memory");
+  return rc;
+}
+
+/**
+* Reads characters from a specified file and places them in a buffer. Reading from the terminal stops
+* after a newline, so each call returns at most one line.
 * 
 * \param fd The file descriptor to read from.
 * \param buf A pointer to store read characters in.
 * \param count The number of character to read.
-* \returns The number of characters read, including the newline character.
+* \returns The number of characters read, including the newline character, or -1 if fd is invalid or buf is not in user memory.
 */
 int64_t read(int fd, void *buf, size_t count);
 
@@ -19,14 +107,59 @@ int64_t read(int fd, void *buf, size_t count);
 * \param fd The file descriptor to read from. Should be 1 or 2.
 * \param buf The buffer to write from.
 * \param count The number of character to write.
-* \returns The number of characters written.
+* \returns The number of characters written, or -1 if fd is invalid or buf is not in user memory.
 */
 int64_t write(int fd, const void *buf, size_t count);
 
 /**
-* Loads a process.
+* Runs a program in a new process and waits for it to exit.
 * 
-* \param name The name of the process to load.
-* \returns -1, since if this point is reached the process was not loaded.
+* \param name The name of the program to run.
+* \returns The low 8 bits of the program's exit code, or -1 if the program was not found, -2 if it was
+* not executable, or -3 if memory ran out.
 */
 int64_t exec(char* name);
+
+/**
+* Creates a copy of the calling process. The copy shares the caller's memory until either one writes to it.
+* 
+* \returns The child's process ID in the parent, 0 in the child, or -1 on error.
+*/
+int64_t fork();
+
+/**
+* Reads how often each system call has been made and how long it took.
+*
+* \param stats An array to fill in, indexed by system call number.
+* \param count The number of entries stats has room for.
+* \returns The number of entries filled in, or -1 if stats is not a valid user address.
+*/
+int64_t syscall_stats(syscall_stats_t* stats, size_t count);
+
+/**
+* Reads the newest messages in the kernel log, oldest first.
+*
+* \param entries An array to fill in.
+* \param count The number of entries the array has room for.
+* \returns The number of entries filled in, or -1 if entries is not a valid user address.
+*/
+int64_t readlog(log_entry_t* entries, size_t count);
+
+/**
+* Reads or changes the terminal's mode. TTY_SET_MODE with TTY_ECHO alone switches to raw mode, where reads
+* return each key as it arrives; TTY_MODE_DEFAULT switches back to reading whole lines.
+*
+* \param fd The terminal's file descriptor, 0, 1 or 2.
+* \param request TTY_GET_MODE or TTY_SET_MODE, from tty_mode.h.
+* \param arg The new mode for TTY_SET_MODE, made of TTY_CANONICAL and TTY_ECHO.
+* \returns The mode for TTY_GET_MODE, 0 for TTY_SET_MODE, or -1 on error.
+*/
+int64_t ioctl(int fd, uint64_t request, uint64_t arg);
+
+/**
+* Gets the name of a system call.
+*
+* \param nr The system call number.
+* \returns The name, or NULL if there is no system call with that number.
+*/
+const char* syscall_name(uint64_t nr);